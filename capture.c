@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "capture.h"
+#include "trace.h"
+#include "estop.h"
+
+typedef struct
+{
+    uint32_t len;
+    uint64_t dropped_before;    /* samples lost between the previous slot and this one */
+    unsigned char data[CAPTURE_CHUNK_SIZE];
+}
+capture_slot_t;
+
+typedef struct
+{
+    capture_slot_t slot[CAPTURE_RING_SLOTS];
+    atomic_uint head;           /* next slot to fill, owned by the USB reader */
+    atomic_uint tail;           /* next slot to encode, owned by the file writer */
+    atomic_int done;
+    FILE *fp;
+    uint8 input_mask;
+    capture_stats_t *stats;
+}
+capture_ring_t;
+
+/**********************************************************
+ * Function put_varint()
+ *
+ * Description: Write an unsigned LEB128 encoded value
+ *
+ * Parameters: fp (in)    - output file
+ *             value (in) - value to encode
+ *
+ * Return:  number of bytes written
+ *********************************************************/
+static int put_varint(FILE *fp, uint64_t value)
+{
+    int n = 0;
+
+    do
+    {
+        unsigned char byte = value & 0x7F;
+        value >>= 7;
+        if (value != 0)
+        {
+            byte |= 0x80;
+        }
+        fputc(byte, fp);
+        n++;
+    }
+    while (value != 0);
+    return n;
+}
+
+/**********************************************************
+ * Function put_run()
+ *
+ * Description: Write one run-length record
+ *********************************************************/
+static void put_run(capture_ring_t *ring, uint8 value, uint64_t run)
+{
+    fputc(CAPTURE_TAG_RUN, ring->fp);
+    fputc(value, ring->fp);
+    ring->stats->bytes_written += 2 + put_varint(ring->fp, run);
+    ring->stats->runs++;
+}
+
+/**********************************************************
+ * Function capture_writer()
+ *
+ * Description: Drain the ring buffer and run-length encode
+ *              the input samples into the capture file
+ *********************************************************/
+static void *capture_writer(void *arg)
+{
+    capture_ring_t *ring = arg;
+    struct timespec idle = { 0, 1000000 };
+    uint8 value = 0;
+    uint64_t run = 0;
+    uint32_t i;
+
+    for (;;)
+    {
+        unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        capture_slot_t *slot;
+
+        if (tail == head)
+        {
+            if (atomic_load(&ring->done) &&
+                    tail == atomic_load_explicit(&ring->head, memory_order_acquire))
+            {
+                break;
+            }
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        slot = &ring->slot[tail & (CAPTURE_RING_SLOTS-1)];
+        if (slot->dropped_before != 0)
+        {
+            if (run != 0)
+            {
+                put_run(ring, value, run);
+                run = 0;
+            }
+            fputc(CAPTURE_TAG_GAP, ring->fp);
+            ring->stats->bytes_written += 1 + put_varint(ring->fp, slot->dropped_before);
+        }
+        for (i = 0; i < slot->len; i++)
+        {
+            uint8 sample = slot->data[i] & ring->input_mask;
+            if (run != 0 && sample == value)
+            {
+                run++;
+                continue;
+            }
+            if (run != 0)
+            {
+                put_run(ring, value, run);
+            }
+            value = sample;
+            run = 1;
+        }
+        atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    }
+
+    if (run != 0)
+    {
+        put_run(ring, value, run);
+    }
+    return NULL;
+}
+
+/**********************************************************
+ * Function capture_push()
+ *
+ * Description: Hand a filled slot to the writer thread
+ *********************************************************/
+static void capture_push(capture_ring_t *ring, unsigned int head, uint32_t len, uint64_t dropped_before)
+{
+    capture_slot_t *slot = &ring->slot[head & (CAPTURE_RING_SLOTS-1)];
+
+    slot->len = len;
+    slot->dropped_before = dropped_before;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**********************************************************
+ * Function capture_run()
+ *
+ * Description: Sample the input pins at the bitbang clock rate
+ *              and stream them run-length encoded to a file.
+ *              USB reads happen on the calling thread; a writer
+ *              thread encodes the samples. When the bounded ring
+ *              between them is full, whole chunks are dropped and
+ *              recorded as a gap so the timeline stays intact.
+ *
+ * Parameters: ftdi (in)   - opened FTDI context
+ *             cfg (in)    - capture configuration
+ *             stats (out) - capture statistics
+ *             stop (in)   - set asynchronously to end the capture
+ *
+ * Return:    0 - success
+ *          < 0 - fail
+ *********************************************************/
+int capture_run(struct ftdi_context *ftdi, const capture_config_t *cfg,
+                capture_stats_t *stats, volatile sig_atomic_t *stop)
+{
+    static unsigned char scratch[CAPTURE_CHUNK_SIZE];
+    capture_ring_t *ring;
+    pthread_t writer;
+    uint64_t pending_dropped = 0;
+    unsigned char header[10];
+    uint32_t rate;
+    int retval = 0;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (cfg->direction_mask == 0xFF)
+    {
+        fprintf(stderr, "ERROR: no pins are configured as inputs\n");
+        return -1;
+    }
+
+    if ((ring = calloc(1, sizeof(*ring))) == NULL)
+    {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return -1;
+    }
+    ring->input_mask = ~cfg->direction_mask;
+    ring->stats = stats;
+
+    if ((ring->fp = fopen(cfg->path, "wb")) == NULL)
+    {
+        fprintf(stderr, "unable to open capture file %s\n", cfg->path);
+        free(ring);
+        return -1;
+    }
+
+    estop_io_lock();
+    if (traced_set_bitmode(ftdi, cfg->direction_mask, BITMODE_BITBANG) < 0 ||
+            traced_set_baudrate(ftdi, cfg->rate) < 0)
+    {
+        estop_io_unlock();
+        fprintf(stderr, "unable to configure sampling: (%s)\n", ftdi_get_error_string(ftdi));
+        fclose(ring->fp);
+        free(ring);
+        return -2;
+    }
+    ftdi_read_data_set_chunksize(ftdi, CAPTURE_CHUNK_SIZE);
+    traced_usb_purge_buffers(ftdi);
+    estop_io_unlock();
+
+    /* libftdi keeps the rate it programmed, scaled by 4 in bitbang mode */
+    rate = ftdi->bitbang_enabled ? ftdi->baudrate / 4 : ftdi->baudrate;
+    if (rate != cfg->rate)
+    {
+        fprintf(stderr, "sampling at %u Hz instead of the requested %u Hz\n", rate, cfg->rate);
+    }
+    stats->rate = rate;
+
+    /* Header: magic, version, input mask, sample rate (little endian) */
+    memcpy(header, CAPTURE_MAGIC, 4);
+    header[4] = CAPTURE_VERSION;
+    header[5] = ring->input_mask;
+    header[6] = rate & 0xFF;
+    header[7] = (rate >> 8) & 0xFF;
+    header[8] = (rate >> 16) & 0xFF;
+    header[9] = (rate >> 24) & 0xFF;
+    fwrite(header, 1, sizeof(header), ring->fp);
+    stats->bytes_written = sizeof(header);
+
+    if (pthread_create(&writer, NULL, capture_writer, ring) != 0)
+    {
+        fprintf(stderr, "unable to start capture writer\n");
+        fclose(ring->fp);
+        free(ring);
+        return -1;
+    }
+
+    while (!*stop && (cfg->max_samples == 0 || stats->samples < cfg->max_samples))
+    {
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        int full = (head - tail) == CAPTURE_RING_SLOTS;
+        unsigned char *buf = full ? scratch : ring->slot[head & (CAPTURE_RING_SLOTS-1)].data;
+        int n;
+
+        /* One chunk at a time, so the emergency stop can write in between */
+        estop_io_lock();
+        n = traced_read_data(ftdi, buf, CAPTURE_CHUNK_SIZE);
+        estop_io_unlock();
+        if (n < 0)
+        {
+            fprintf(stderr, "read failed, error %s\n", ftdi_get_error_string(ftdi));
+            retval = -3;
+            break;
+        }
+        if (n == 0)
+        {
+            continue;
+        }
+        if (cfg->max_samples != 0 && stats->samples + n > cfg->max_samples)
+        {
+            n = cfg->max_samples - stats->samples;
+        }
+
+        stats->samples += n;
+        if (full)
+        {
+            pending_dropped += n;
+            stats->dropped += n;
+        }
+        else
+        {
+            capture_push(ring, head, n, pending_dropped);
+            pending_dropped = 0;
+        }
+    }
+
+    /* Make sure a trailing gap is recorded as well */
+    if (pending_dropped != 0)
+    {
+        struct timespec idle = { 0, 1000000 };
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+        while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == CAPTURE_RING_SLOTS)
+        {
+            nanosleep(&idle, NULL);
+        }
+        capture_push(ring, head, 0, pending_dropped);
+    }
+
+    atomic_store(&ring->done, 1);
+    pthread_join(writer, NULL);
+
+    fputc(CAPTURE_TAG_END, ring->fp);
+    stats->bytes_written += 1 + put_varint(ring->fp, stats->samples);
+    stats->bytes_written += put_varint(ring->fp, stats->dropped);
+    if (fclose(ring->fp) != 0)
+    {
+        fprintf(stderr, "unable to write capture file %s\n", cfg->path);
+        retval = -1;
+    }
+    free(ring);
+    return retval;
+}
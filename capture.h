@@ -0,0 +1,43 @@
+#ifndef capture_h
+#define capture_h
+
+#include <signal.h>
+#include <stdint.h>
+#include <ftdi.h>
+
+#include "sainsmartrelay.h"
+
+#define CAPTURE_MAGIC        "SRCP"
+#define CAPTURE_VERSION      1
+#define CAPTURE_DEFAULT_RATE 10000
+#define CAPTURE_CHUNK_SIZE   4096
+#define CAPTURE_RING_SLOTS   64   /* must be a power of two */
+
+/* Record tags following the file header */
+#define CAPTURE_TAG_RUN      0x00 /* value byte, varint run length */
+#define CAPTURE_TAG_GAP      0x01 /* varint number of dropped samples */
+#define CAPTURE_TAG_END      0xFF /* varint total samples, varint dropped samples */
+
+typedef struct
+{
+    const char *path;         /* output file */
+    uint8 direction_mask;     /* bitbang direction, 1 = output */
+    uint32_t rate;            /* requested sample rate in Hz */
+    uint64_t max_samples;     /* stop after this many samples, 0 = until stopped */
+}
+capture_config_t;
+
+typedef struct
+{
+    uint64_t samples;         /* samples read from the card */
+    uint64_t dropped;         /* samples lost because the ring buffer was full */
+    uint64_t runs;            /* run-length records written */
+    uint64_t bytes_written;   /* size of the capture file */
+    uint32_t rate;            /* sample rate programmed into the card, in Hz */
+}
+capture_stats_t;
+
+int capture_run(struct ftdi_context *ftdi, const capture_config_t *cfg,
+                capture_stats_t *stats, volatile sig_atomic_t *stop);
+
+#endif
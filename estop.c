@@ -0,0 +1,304 @@
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "estop.h"
+#include "trace.h"
+
+/*
+ * The all-off write is done by a dedicated thread started by
+ * estop_arm(). A trigger only latches the stop and posts a semaphore,
+ * so it is async-signal-safe and never touches the libftdi context
+ * itself. Every other use of the card handle holds g_estop_io_lock,
+ * which the stop thread takes for its write; since the card timeouts
+ * are ESTOP_WRITE_TIMEOUT_MS, the stop never waits longer than one
+ * transfer, and a relay write either completes before the all-off
+ * write or sees the latch and is refused.
+ */
+static pthread_mutex_t g_estop_io_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ftdi_context *g_estop_ftdi = NULL;
+static unsigned char g_estop_buf[1];
+static atomic_int g_estop_armed;
+static atomic_int g_estop_latched;       /* shared with the relay writer threads */
+static atomic_ulong g_estop_requests;
+static atomic_uint_fast64_t g_estop_request_ns;
+static sem_t g_estop_sem;
+static pthread_t g_estop_thread;
+static int g_estop_thread_started = 0;
+
+/* Written by the stop thread only, read under g_estop_done_lock */
+static pthread_mutex_t g_estop_done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_estop_done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long g_estop_done = 0;
+static int g_estop_result = 0;
+static estop_stats_t g_estop_stats;
+
+/**********************************************************
+ * Function estop_write_off()
+ *
+ * Description: Write the all-off byte under the I/O lock.
+ *              Failed writes are retried up to
+ *              ESTOP_MAX_ATTEMPTS times.
+ *
+ * Parameters: attempts (out) - number of writes issued
+ *
+ * Return:    0 - success, outputs de-energised
+ *           -1 - fail, disarmed or every attempt failed
+ *********************************************************/
+static int estop_write_off(int *attempts)
+{
+    int ret = -1;
+
+    *attempts = 0;
+    estop_io_lock();
+    while (atomic_load(&g_estop_armed) && *attempts < ESTOP_MAX_ATTEMPTS)
+    {
+        (*attempts)++;
+        if (traced_write(g_estop_ftdi, g_estop_buf, 1) == 1)
+        {
+            ret = 0;
+            break;
+        }
+    }
+    estop_io_unlock();
+    return ret;
+}
+
+/**********************************************************
+ * Function estop_thread()
+ *
+ * Description: Wait for triggers and switch the outputs off,
+ *              keeping the latency statistics
+ *********************************************************/
+static void *estop_thread(void *arg)
+{
+    (void)arg;
+
+    for (;;)
+    {
+        uint64_t start_ns, elapsed_ns;
+        int attempts, ret;
+
+        if (sem_wait(&g_estop_sem) != 0)
+        {
+            /* EINTR: a signal handler ran on this thread */
+            continue;
+        }
+        /* 0 if an earlier wakeup already took the timestamp */
+        if ((start_ns = atomic_exchange(&g_estop_request_ns, 0)) == 0)
+        {
+            start_ns = trace_now_ns();
+        }
+        ret = estop_write_off(&attempts);
+        elapsed_ns = trace_now_ns() - start_ns;
+
+        pthread_mutex_lock(&g_estop_done_lock);
+        g_estop_stats.triggers++;
+        g_estop_stats.retries += (attempts > 1) ? attempts - 1 : 0;
+        g_estop_stats.last_ns = elapsed_ns;
+        g_estop_stats.sum_ns += elapsed_ns;
+        if (g_estop_stats.triggers == 1 || elapsed_ns < g_estop_stats.min_ns)
+        {
+            g_estop_stats.min_ns = elapsed_ns;
+        }
+        if (elapsed_ns > g_estop_stats.max_ns)
+        {
+            g_estop_stats.max_ns = elapsed_ns;
+        }
+        if (ret != 0)
+        {
+            g_estop_stats.failures++;
+        }
+        g_estop_result = ret;
+        g_estop_done++;
+        pthread_cond_broadcast(&g_estop_done_cond);
+        pthread_mutex_unlock(&g_estop_done_lock);
+    }
+    return NULL;
+}
+
+/**********************************************************
+ * Function estop_arm()
+ *
+ * Description: Prepare the emergency stop on an open card that
+ *              is already in bitbang mode: set the short USB
+ *              timeouts and start the stop thread
+ *
+ * Parameters: ftdi (in)     - opened FTDI context, kept open
+ *             off_data (in) - precomputed output byte with every
+ *                             relay de-energised
+ *
+ * Return:    0 - success
+ *           -1 - fail, no device or no stop thread
+ *********************************************************/
+int estop_arm(struct ftdi_context *ftdi, uint8 off_data)
+{
+    if (ftdi == NULL)
+    {
+        return -1;
+    }
+
+    estop_io_lock();
+    g_estop_ftdi = ftdi;
+    g_estop_buf[0] = off_data;
+    ftdi->usb_write_timeout = ESTOP_WRITE_TIMEOUT_MS;
+    ftdi->usb_read_timeout = ESTOP_WRITE_TIMEOUT_MS;
+    estop_io_unlock();
+
+    if (!g_estop_thread_started)
+    {
+        if (sem_init(&g_estop_sem, 0, 0) != 0)
+        {
+            return -1;
+        }
+        if (pthread_create(&g_estop_thread, NULL, estop_thread, NULL) != 0)
+        {
+            sem_destroy(&g_estop_sem);
+            return -1;
+        }
+        g_estop_thread_started = 1;
+    }
+
+    pthread_mutex_lock(&g_estop_done_lock);
+    memset(&g_estop_stats, 0, sizeof(g_estop_stats));
+    pthread_mutex_unlock(&g_estop_done_lock);
+    atomic_store(&g_estop_armed, 1);
+    return 0;
+}
+
+/**********************************************************
+ * Function estop_disarm()
+ *
+ * Description: Stop using the card before it is closed. A
+ *              trigger after this still latches, but writes
+ *              nothing.
+ *********************************************************/
+void estop_disarm(void)
+{
+    estop_io_lock();
+    atomic_store(&g_estop_armed, 0);
+    estop_io_unlock();
+}
+
+/**********************************************************
+ * Function estop_post()
+ *
+ * Description: Latch the stop and wake the stop thread.
+ *              Async-signal-safe.
+ *
+ * Return:  number of the request, which is complete once the
+ *          stop thread has handled that many, 0 if not armed
+ *********************************************************/
+static unsigned long estop_post(void)
+{
+    uint_fast64_t none = 0;
+    unsigned long ticket;
+
+    atomic_store(&g_estop_latched, 1);
+    if (!atomic_load(&g_estop_armed))
+    {
+        return 0;
+    }
+    atomic_compare_exchange_strong(&g_estop_request_ns, &none, trace_now_ns());
+    ticket = atomic_fetch_add(&g_estop_requests, 1) + 1;
+    sem_post(&g_estop_sem);
+    return ticket;
+}
+
+/**********************************************************
+ * Function estop_request()
+ *
+ * Description: Latch the stop and wake the stop thread, without
+ *              waiting for the write. Async-signal-safe, for
+ *              signal handlers and watchdog timeouts.
+ *********************************************************/
+void estop_request(void)
+{
+    estop_post();
+}
+
+/**********************************************************
+ * Function estop_trigger()
+ *
+ * Description: Request the stop and wait until the stop thread
+ *              has written the all-off byte. The time until it
+ *              gives up is bounded by ESTOP_WORST_CASE_MS. Once
+ *              triggered the stop stays latched, see
+ *              estop_latched(). Not for signal handlers, use
+ *              estop_request() there.
+ *
+ * Return:    0 - success, outputs de-energised
+ *           -1 - fail, not armed or every attempt failed
+ *********************************************************/
+int estop_trigger(void)
+{
+    unsigned long ticket;
+    int ret;
+
+    if ((ticket = estop_post()) == 0)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_estop_done_lock);
+    while (g_estop_done < ticket)
+    {
+        pthread_cond_wait(&g_estop_done_cond, &g_estop_done_lock);
+    }
+    ret = g_estop_result;
+    pthread_mutex_unlock(&g_estop_done_lock);
+    return ret;
+}
+
+/**********************************************************
+ * Function estop_latched()
+ *
+ * Description: Whether the emergency stop was triggered. No
+ *              further relay writes may be issued afterwards.
+ *********************************************************/
+int estop_latched(void)
+{
+    return atomic_load(&g_estop_latched);
+}
+
+/**********************************************************
+ * Function estop_reset()
+ *
+ * Description: Clear the latch so relay writes are accepted
+ *              again. Only for --estop-test, which triggers the
+ *              stop repeatedly against a running writer.
+ *********************************************************/
+void estop_reset(void)
+{
+    atomic_store(&g_estop_latched, 0);
+}
+
+/**********************************************************
+ * Function estop_get_stats()
+ *
+ * Description: Copy the trigger latency statistics
+ *********************************************************/
+void estop_get_stats(estop_stats_t *stats)
+{
+    pthread_mutex_lock(&g_estop_done_lock);
+    *stats = g_estop_stats;
+    pthread_mutex_unlock(&g_estop_done_lock);
+}
+
+/**********************************************************
+ * Function estop_io_lock()
+ *
+ * Description: Take the lock that serialises every use of the
+ *              card handle with the stop thread. Held for one
+ *              transfer at a time, never across a sleep.
+ *********************************************************/
+void estop_io_lock(void)
+{
+    pthread_mutex_lock(&g_estop_io_lock);
+}
+
+void estop_io_unlock(void)
+{
+    pthread_mutex_unlock(&g_estop_io_lock);
+}
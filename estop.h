@@ -0,0 +1,39 @@
+#ifndef estop_h
+#define estop_h
+
+#include <stdint.h>
+#include <ftdi.h>
+
+#include "sainsmartrelay.h"
+
+#define ESTOP_MAX_ATTEMPTS      8
+/* USB read and write timeout of the armed card, and so the longest
+ * time any holder of the I/O lock can keep the stop waiting */
+#define ESTOP_WRITE_TIMEOUT_MS  20
+/* Upper bound from trigger to de-energised outputs, excluding scheduling
+ * delays: one transfer in progress, then every attempt of the stop */
+#define ESTOP_WORST_CASE_MS     ((ESTOP_MAX_ATTEMPTS + 1) * ESTOP_WRITE_TIMEOUT_MS)
+
+typedef struct
+{
+    uint64_t triggers;
+    uint64_t failures;          /* triggers where every attempt failed */
+    uint64_t retries;           /* attempts beyond the first */
+    uint64_t last_ns;           /* trigger to completed write */
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t sum_ns;
+}
+estop_stats_t;
+
+int estop_arm(struct ftdi_context *ftdi, uint8 off_data);
+void estop_disarm(void);
+void estop_request(void);
+int estop_trigger(void);
+int estop_latched(void);
+void estop_reset(void);
+void estop_get_stats(estop_stats_t *stats);
+void estop_io_lock(void);
+void estop_io_unlock(void);
+
+#endif
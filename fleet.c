@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <ftdi.h>
+
+#include "fleet.h"
+
+typedef struct
+{
+    struct usb_device *dev;
+    char location[32];          /* BUS/DEV, usable as --device d:BUS/DEV */
+    char manufacturer[128];
+    char description[128];
+    char serial[64];
+    int type;
+    unsigned int chipid;
+    uint8 pins;
+    int have_chipid;
+    int have_pins;
+    int busy;                   /* claimed by ftdi_sio or another program */
+    char error[160];            /* empty if every probe step succeeded */
+}
+fleet_card_t;
+
+static const char *chip_type_name(int type)
+{
+    switch (type)
+    {
+    case TYPE_AM:
+        return "AM";
+    case TYPE_BM:
+        return "BM";
+    case TYPE_2232C:
+        return "2232C";
+    case TYPE_R:
+        return "R";
+    case TYPE_2232H:
+        return "2232H";
+    case TYPE_4232H:
+        return "4232H";
+    default:
+        return "unknown";
+    }
+}
+
+static void fleet_error(fleet_card_t *card, const char *step, struct ftdi_context *ftdi)
+{
+    size_t used = strlen(card->error);
+
+    snprintf(card->error + used, sizeof(card->error) - used, "%s%s: %s",
+             used ? "; " : "", step, ftdi ? ftdi_get_error_string(ftdi) : "out of memory");
+}
+
+/**********************************************************
+ * Function fleet_probe()
+ *
+ * Description: Read strings, chip type, chip ID and pin state
+ *              of one card. Every card gets its own context and
+ *              thread, and a failing step only marks this card.
+ *              The card is only read: the bit mode is left as it
+ *              is so the relays do not change state, and a card
+ *              bound to ftdi_sio is reported as busy instead of
+ *              being detached from its serial driver.
+ *********************************************************/
+static void *fleet_probe(void *arg)
+{
+    fleet_card_t *card = arg;
+    struct ftdi_context *ftdi;
+    int ret;
+
+    card->type = -1;
+    snprintf(card->location, sizeof(card->location), "%.8s/%.8s",
+             card->dev->bus->dirname, card->dev->filename);
+
+    if ((ftdi = ftdi_new()) == NULL)
+    {
+        fleet_error(card, "ftdi_new", NULL);
+        return NULL;
+    }
+
+    if (ftdi_usb_get_strings(ftdi, card->dev, card->manufacturer, sizeof(card->manufacturer),
+                             card->description, sizeof(card->description),
+                             card->serial, sizeof(card->serial)) < 0)
+    {
+        fleet_error(card, "strings", ftdi);
+    }
+
+    ftdi->module_detach_mode = DONT_DETACH_SIO_MODULE;
+    if ((ret = ftdi_usb_open_dev(ftdi, card->dev)) < 0)
+    {
+        /* -5: the interface could not be claimed, i.e. a kernel
+         * driver or another program holds the card */
+        if (ret == -5)
+        {
+            card->busy = 1;
+        }
+        else
+        {
+            fleet_error(card, "open", ftdi);
+        }
+        ftdi_free(ftdi);
+        return NULL;
+    }
+    card->type = ftdi->type;
+
+    if (ftdi_read_chipid(ftdi, &card->chipid) < 0)
+    {
+        fleet_error(card, "chipid", ftdi);
+    }
+    else
+    {
+        card->have_chipid = 1;
+    }
+
+    if (ftdi_read_pins(ftdi, &card->pins) < 0)
+    {
+        fleet_error(card, "pins", ftdi);
+    }
+    else
+    {
+        card->have_pins = 1;
+    }
+
+    ftdi_usb_close(ftdi);
+    ftdi_free(ftdi);
+    return NULL;
+}
+
+static void json_string(const char *str)
+{
+    putchar('"');
+    for (; *str != '\0'; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            printf("\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            printf("\\u%04x", (unsigned char)*str);
+        else
+            putchar(*str);
+    }
+    putchar('"');
+}
+
+static void print_table(const fleet_card_t *cards, int num_cards)
+{
+    int i;
+
+    printf("%-9s %-16s %-24s %-12s %-6s %-10s %-5s %s\n",
+           "DEVICE", "MANUFACTURER", "DESCRIPTION", "SERIAL", "CHIP", "CHIPID", "PINS", "ERROR");
+    for (i = 0; i < num_cards; i++)
+    {
+        const fleet_card_t *card = &cards[i];
+        char chipid[12] = "-", pins[8] = "-";
+
+        if (card->have_chipid)
+            snprintf(chipid, sizeof(chipid), "%08X", card->chipid);
+        if (card->have_pins)
+            snprintf(pins, sizeof(pins), "0x%02X", card->pins);
+        printf("%-9s %-16s %-24s %-12s %-6s %-10s %-5s %s%s%s\n", card->location,
+               card->manufacturer, card->description, card->serial,
+               chip_type_name(card->type), chipid, pins,
+               card->busy ? "busy (bound to ftdi_sio or in use)" : "",
+               (card->busy && card->error[0] != '\0') ? "; " : "", card->error);
+    }
+}
+
+static void print_json(const fleet_card_t *cards, int num_cards)
+{
+    int i;
+
+    printf("[");
+    for (i = 0; i < num_cards; i++)
+    {
+        const fleet_card_t *card = &cards[i];
+
+        printf("%s\n  {\"device\": ", i ? "," : "");
+        json_string(card->location);
+        printf(", \"manufacturer\": ");
+        json_string(card->manufacturer);
+        printf(", \"description\": ");
+        json_string(card->description);
+        printf(", \"serial\": ");
+        json_string(card->serial);
+        printf(", \"chip\": \"%s\"", chip_type_name(card->type));
+        if (card->have_chipid)
+            printf(", \"chipid\": \"%08X\"", card->chipid);
+        else
+            printf(", \"chipid\": null");
+        if (card->have_pins)
+            printf(", \"pins\": %u", card->pins);
+        else
+            printf(", \"pins\": null");
+        printf(", \"busy\": %s", card->busy ? "true" : "false");
+        printf(", \"error\": ");
+        if (card->error[0] != '\0')
+            json_string(card->error);
+        else
+            printf("null");
+        printf("}");
+    }
+    printf("%s]\n", num_cards ? "\n" : "");
+}
+
+/**********************************************************
+ * Function fleet_discover()
+ *
+ * Description: Probe every connected Sainsmart card at the
+ *              same time and print one table or JSON document
+ *              with the status of all of them
+ *
+ * Parameters: format (in) - output format
+ *
+ * Return:    0 - success, every card answered
+ *           -1 - fail, no card could be listed
+ *           -2 - at least one card was busy or reported an error
+ *********************************************************/
+int fleet_discover(fleet_format_t format)
+{
+    struct ftdi_context *ftdi;
+    struct ftdi_device_list *devlist, *curdev;
+    fleet_card_t *cards;
+    pthread_t *threads;
+    int num_cards, i;
+    int retval = 0;
+
+    if ((ftdi = ftdi_new()) == 0)
+    {
+        fprintf(stderr, "ftdi_new failed\n");
+        return -1;
+    }
+
+    if ((num_cards = ftdi_usb_find_all(ftdi, &devlist, VENDOR_ID, DEVICE_ID)) < 0)
+    {
+        fprintf(stderr, "ftdi_usb_find_all failed: %d (%s)\n", num_cards, ftdi_get_error_string(ftdi));
+        ftdi_free(ftdi);
+        return -1;
+    }
+
+    cards = calloc(num_cards ? num_cards : 1, sizeof(fleet_card_t));
+    threads = calloc(num_cards ? num_cards : 1, sizeof(pthread_t));
+    if (cards == NULL || threads == NULL)
+    {
+        fprintf(stderr, "ERROR: out of memory\n");
+        free(cards);
+        free(threads);
+        ftdi_list_free(&devlist);
+        ftdi_free(ftdi);
+        return -1;
+    }
+
+    for (i = 0, curdev = devlist; curdev != NULL && i < num_cards; curdev = curdev->next, i++)
+    {
+        cards[i].dev = curdev->dev;
+        if (pthread_create(&threads[i], NULL, fleet_probe, &cards[i]) != 0)
+        {
+            /* Fall back to probing this card on the calling thread */
+            threads[i] = 0;
+            fleet_probe(&cards[i]);
+        }
+    }
+    for (i = 0; i < num_cards; i++)
+    {
+        if (threads[i] != 0)
+        {
+            pthread_join(threads[i], NULL);
+        }
+        if (cards[i].busy || cards[i].error[0] != '\0')
+        {
+            retval = -2;
+        }
+    }
+
+    if (format == FLEET_JSON)
+        print_json(cards, num_cards);
+    else
+        print_table(cards, num_cards);
+
+    free(threads);
+    free(cards);
+    ftdi_list_free(&devlist);
+    ftdi_free(ftdi);
+    return retval;
+}
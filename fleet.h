@@ -0,0 +1,15 @@
+#ifndef fleet_h
+#define fleet_h
+
+#include "sainsmartrelay.h"
+
+typedef enum
+{
+    FLEET_TABLE = 0,
+    FLEET_JSON
+}
+fleet_format_t;
+
+int fleet_discover(fleet_format_t format);
+
+#endif
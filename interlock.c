@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "interlock.h"
+
+/**********************************************************
+ * Function interlock_init()
+ *
+ * Description: Reset the rule set so every mask is allowed
+ *
+ * Parameters: il (out) - interlock rule set
+ *********************************************************/
+void interlock_init(interlock_t *il)
+{
+    memset(il, 0, sizeof(*il));
+}
+
+/**********************************************************
+ * Function interlock_parse()
+ *
+ * Description: Parse an interlock specification and add its
+ *              rules to the rule set. Rules are separated by
+ *              commas, the relays of one rule by '+', e.g.
+ *              "1+2,3+4" forbids relays 1 and 2 from being on
+ *              together, and likewise relays 3 and 4.
+ *
+ * Parameters: il (in/out)     - interlock rule set
+ *             spec (in)       - rule specification
+ *             num_relays (in) - number of relays on the card
+ *
+ * Return:    0 - success
+ *           -1 - fail, malformed specification
+ *********************************************************/
+int interlock_parse(interlock_t *il, const char *spec, uint8 num_relays)
+{
+    const char *p = spec;
+
+    while (*p != '\0')
+    {
+        uint8 mask = 0;
+
+        while (*p == ',' || *p == ' ')
+        {
+            p++;
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+
+        for (;;)
+        {
+            char *end;
+            long relay = strtol(p, &end, 10);
+
+            if (end == p || relay < FIRST_RELAY || relay > (FIRST_RELAY+num_relays-1))
+            {
+                fprintf(stderr, "ERROR: invalid relay in interlock rule \"%s\"\n", spec);
+                return -1;
+            }
+            mask |= (0x01<<(relay-1));
+            p = end;
+            if (*p != '+')
+            {
+                break;
+            }
+            p++;
+        }
+
+        if (*p != '\0' && *p != ',' && *p != ' ')
+        {
+            fprintf(stderr, "ERROR: malformed interlock rule \"%s\"\n", spec);
+            return -1;
+        }
+        /* "1+1" names one relay twice and would forbid switching it on */
+        if ((mask & (mask - 1)) == 0)
+        {
+            fprintf(stderr, "ERROR: interlock rule needs at least two different relays \"%s\"\n", spec);
+            return -1;
+        }
+        if (il->num_rules == MAX_INTERLOCK_RULES)
+        {
+            fprintf(stderr, "ERROR: too many interlock rules (max %d)\n", MAX_INTERLOCK_RULES);
+            return -1;
+        }
+        il->rule_mask[il->num_rules++] = mask;
+    }
+
+    interlock_compile(il);
+    return 0;
+}
+
+/**********************************************************
+ * Function interlock_compile()
+ *
+ * Description: Build the lookup table over every possible
+ *              8-bit output mask. Earlier rules take
+ *              precedence when reporting a violation.
+ *
+ * Parameters: il (in/out) - interlock rule set
+ *********************************************************/
+void interlock_compile(interlock_t *il)
+{
+    int data, rule;
+
+    for (data = 0; data < 256; data++)
+    {
+        il->table[data] = 0;
+        for (rule = 0; rule < il->num_rules; rule++)
+        {
+            if ((data & il->rule_mask[rule]) == il->rule_mask[rule])
+            {
+                il->table[data] = rule + 1;
+                break;
+            }
+        }
+    }
+}
+
+/**********************************************************
+ * Function interlock_rule_string()
+ *
+ * Description: Format a rule the way it is specified, e.g. "1+2"
+ *
+ * Parameters: il (in)   - interlock rule set
+ *             rule (in) - rule number as returned by interlock_check()
+ *             str (out) - destination buffer
+ *             len (in)  - size of destination buffer
+ *
+ * Return:  str
+ *********************************************************/
+char *interlock_rule_string(const interlock_t *il, int rule, char *str, size_t len)
+{
+    size_t used = 0;
+    int bit;
+
+    str[0] = '\0';
+    if (rule < 1 || rule > il->num_rules)
+    {
+        return str;
+    }
+
+    for (bit = 0; bit < 8 && used < len; bit++)
+    {
+        if (il->rule_mask[rule-1] & (0x01<<bit))
+        {
+            used += snprintf(str + used, len - used, "%s%d", used ? "+" : "", bit + 1);
+        }
+    }
+    return str;
+}
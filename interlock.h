@@ -0,0 +1,46 @@
+#ifndef interlock_h
+#define interlock_h
+
+#include <stddef.h>
+
+#include "sainsmartrelay.h"
+
+#define MAX_INTERLOCK_RULES 32
+#define INTERLOCK_ENV "SAINSMART_INTERLOCK"
+
+/*
+ * A rule is the set of relays that must never be on at the same time.
+ * The rules are compiled into a table over every possible output mask,
+ * so checking a candidate mask before it is written is a single lookup.
+ */
+typedef struct
+{
+    uint8 num_rules;
+    uint8 rule_mask[MAX_INTERLOCK_RULES];
+    uint8 table[256];   /* 0 = allowed, otherwise index of the violated rule + 1 */
+}
+interlock_t;
+
+void interlock_init(interlock_t *il);
+int interlock_parse(interlock_t *il, const char *spec, uint8 num_relays);
+void interlock_compile(interlock_t *il);
+char *interlock_rule_string(const interlock_t *il, int rule, char *str, size_t len);
+
+/**********************************************************
+ * Function interlock_check()
+ *
+ * Description: Check an output mask against the compiled
+ *              interlock table
+ *
+ * Parameters: il (in)   - compiled interlock rule set
+ *             data (in) - candidate output mask
+ *
+ * Return:    0 - mask is allowed
+ *          > 0 - number of the first violated rule
+ *********************************************************/
+static inline int interlock_check(const interlock_t *il, uint8 data)
+{
+    return il->table[data];
+}
+
+#endif
@@ -0,0 +1,299 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "react.h"
+#include "trace.h"
+
+typedef struct
+{
+    const react_rules_t *rules;
+    react_read_fn read;
+    react_write_fn write;
+    void *ctx;
+    int cpu;
+    volatile sig_atomic_t *stop;
+    react_stats_t *stats;
+    int retval;
+}
+react_job_t;
+
+/**********************************************************
+ * Function react_parse()
+ *
+ * Description: Parse and compile reaction rules. Rules are
+ *              separated by ';' and have the form
+ *              PIN:EDGE=ACTION:RELAYS, e.g. "5:rise=off:1" opens
+ *              relay 1 when input pin 5 goes high. EDGE is rise,
+ *              fall or any, ACTION is on or off and RELAYS is a
+ *              comma separated relay list. When rules triggered by
+ *              the same poll disagree, off wins.
+ *
+ * Parameters: rules (out)      - compiled rules
+ *             spec (in)        - rule specification
+ *             input_mask (in)  - pins configured as inputs
+ *             num_relays (in)  - number of relays on the card
+ *
+ * Return:    0 - success
+ *           -1 - fail, malformed specification
+ *********************************************************/
+int react_parse(react_rules_t *rules, const char *spec, uint8 input_mask, uint8 num_relays)
+{
+    uint8 pin_rise_on[8] = { 0 }, pin_rise_off[8] = { 0 };
+    uint8 pin_fall_on[8] = { 0 }, pin_fall_off[8] = { 0 };
+    char *copy = strdup(spec);
+    char *rule, *ctx;
+    int edges, pin;
+
+    memset(rules, 0, sizeof(*rules));
+    rules->input_mask = input_mask;
+
+    for (rule = strtok_r(copy, ";", &ctx); rule != NULL; rule = strtok_r(NULL, ";", &ctx))
+    {
+        char edge[8], action[8], relays[64];
+        uint8 mask = 0;
+        char *p, *end;
+        int used = 0;
+
+        if (sscanf(rule, " %d:%7[a-z]=%7[a-z]:%63s%n", &pin, edge, action, relays, &used) != 4 ||
+                rule[used + strspn(rule + used, " \t\n")] != '\0' || pin < 1 || pin > 8)
+        {
+            fprintf(stderr, "ERROR: malformed reaction rule \"%s\"\n", rule);
+            goto fail;
+        }
+        if (!(input_mask & (0x01<<(pin-1))))
+        {
+            fprintf(stderr, "ERROR: pin %d in reaction rule \"%s\" is not an input\n", pin, rule);
+            goto fail;
+        }
+
+        for (p = relays;; p = end + 1)
+        {
+            long relay = strtol(p, &end, 10);
+            if (end == p || relay < FIRST_RELAY || relay > (FIRST_RELAY+num_relays-1))
+            {
+                fprintf(stderr, "ERROR: invalid relay in reaction rule \"%s\"\n", rule);
+                goto fail;
+            }
+            mask |= (0x01<<(relay-1));
+            if (*end == '\0')
+            {
+                break;
+            }
+            if (*end != ',')
+            {
+                fprintf(stderr, "ERROR: invalid relay in reaction rule \"%s\"\n", rule);
+                goto fail;
+            }
+        }
+
+        if (strcmp(edge, "rise") == 0)
+            edges = 1;
+        else if (strcmp(edge, "fall") == 0)
+            edges = 2;
+        else if (strcmp(edge, "any") == 0)
+            edges = 3;
+        else
+        {
+            fprintf(stderr, "ERROR: unknown edge \"%s\", use rise, fall or any\n", edge);
+            goto fail;
+        }
+        if (strcmp(action, "on") != 0 && strcmp(action, "off") != 0)
+        {
+            fprintf(stderr, "ERROR: unknown action \"%s\", use on or off\n", action);
+            goto fail;
+        }
+
+        if (edges & 1)
+        {
+            if (action[1] == 'n') pin_rise_on[pin-1] |= mask;
+            else pin_rise_off[pin-1] |= mask;
+        }
+        if (edges & 2)
+        {
+            if (action[1] == 'n') pin_fall_on[pin-1] |= mask;
+            else pin_fall_off[pin-1] |= mask;
+        }
+        rules->num_rules++;
+    }
+    free(copy);
+
+    /* Combine the per pin actions for every set of edges */
+    for (edges = 0; edges < 256; edges++)
+    {
+        for (pin = 0; pin < 8; pin++)
+        {
+            if (edges & (0x01<<pin))
+            {
+                rules->rise_on[edges] |= pin_rise_on[pin];
+                rules->rise_off[edges] |= pin_rise_off[pin];
+                rules->fall_on[edges] |= pin_fall_on[pin];
+                rules->fall_off[edges] |= pin_fall_off[pin];
+            }
+        }
+    }
+    return 0;
+
+fail:
+    free(copy);
+    return -1;
+}
+
+/**********************************************************
+ * Function react_loop()
+ *
+ * Description: Poll the inputs and apply the rule outputs.
+ *              Runs on its own thread, pinned to a CPU when
+ *              requested and at real-time priority if allowed.
+ *********************************************************/
+static void *react_loop(void *arg)
+{
+    react_job_t *job = arg;
+    const react_rules_t *rules = job->rules;
+    react_stats_t *stats = job->stats;
+    uint64_t prev_ns, now_ns, done_ns;
+    uint8 pins, inputs, state;
+    struct sched_param param;
+
+    if (job->cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(job->cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+        {
+            fprintf(stderr, "Warning: unable to pin reaction thread to CPU %d\n", job->cpu);
+        }
+    }
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    if (job->read(&pins, job->ctx) != 0)
+    {
+        job->retval = -3;
+        return NULL;
+    }
+    state = pins & ~rules->input_mask;
+    inputs = pins & rules->input_mask;
+    prev_ns = trace_now_ns();
+
+    while (!*job->stop)
+    {
+        uint8 rises, falls, on, off, next;
+        int ret;
+
+        if (job->read(&pins, job->ctx) != 0)
+        {
+            job->retval = -3;
+            break;
+        }
+        now_ns = trace_now_ns();
+        stats->polls++;
+        if (now_ns - prev_ns > stats->poll_max_ns)
+        {
+            stats->poll_max_ns = now_ns - prev_ns;
+        }
+        prev_ns = now_ns;
+
+        pins &= rules->input_mask;
+        if (pins == inputs)
+        {
+            continue;
+        }
+        rises = pins & ~inputs;
+        falls = inputs & ~pins;
+        inputs = pins;
+
+        on = rules->rise_on[rises] | rules->fall_on[falls];
+        off = rules->rise_off[rises] | rules->fall_off[falls];
+        next = (state | on) & ~off;
+        if (next == state)
+        {
+            continue;
+        }
+
+        ret = job->write(next, job->ctx);
+        done_ns = trace_now_ns();
+        if (ret == RELAY_ERR_INTERLOCK)
+        {
+            stats->rejected++;
+            continue;
+        }
+        if (ret != 0)
+        {
+            job->retval = -4;
+            break;
+        }
+        state = next;
+
+        stats->reactions++;
+        stats->react_sum_ns += done_ns - now_ns;
+        if (stats->reactions == 1 || done_ns - now_ns < stats->react_min_ns)
+        {
+            stats->react_min_ns = done_ns - now_ns;
+        }
+        if (done_ns - now_ns > stats->react_max_ns)
+        {
+            stats->react_max_ns = done_ns - now_ns;
+        }
+    }
+    return NULL;
+}
+
+/**********************************************************
+ * Function react_run()
+ *
+ * Description: Run the reaction engine until stopped
+ *
+ * Parameters: rules (in)  - compiled rules
+ *             read (in)   - reads the pins of the card
+ *             write (in)  - writes a new output mask
+ *             ctx (in)    - passed to read and write
+ *             cpu (in)    - CPU to pin the polling thread to, -1 for any
+ *             stop (in)   - set asynchronously to end the run
+ *             stats (out) - reaction statistics
+ *
+ * Return:    0 - success
+ *          < 0 - fail
+ *********************************************************/
+int react_run(const react_rules_t *rules, react_read_fn read, react_write_fn write, void *ctx,
+              int cpu, volatile sig_atomic_t *stop, react_stats_t *stats)
+{
+    react_job_t job = { rules, read, write, ctx, cpu, stop, stats, 0 };
+    pthread_t thread;
+
+    memset(stats, 0, sizeof(*stats));
+    if (pthread_create(&thread, NULL, react_loop, &job) != 0)
+    {
+        fprintf(stderr, "unable to start reaction thread\n");
+        return -1;
+    }
+    pthread_join(thread, NULL);
+    return job.retval;
+}
+
+/**********************************************************
+ * Function react_report()
+ *
+ * Description: Print the reaction statistics. The worst case
+ *              from an input edge to the outputs is bounded by
+ *              the longest poll gap plus the slowest reaction.
+ *********************************************************/
+void react_report(const react_stats_t *stats, FILE *out)
+{
+    fprintf(out, "polls: %llu, reactions: %llu, rejected: %llu\n",
+            (unsigned long long)stats->polls, (unsigned long long)stats->reactions,
+            (unsigned long long)stats->rejected);
+    fprintf(out, "max poll interval: %.1f us\n", stats->poll_max_ns / 1000.0);
+    if (stats->reactions != 0)
+    {
+        fprintf(out, "edge to output: min %.1f us, avg %.1f us, max %.1f us\n",
+                stats->react_min_ns / 1000.0, stats->react_sum_ns / 1000.0 / stats->reactions,
+                stats->react_max_ns / 1000.0);
+        fprintf(out, "worst case bound: %.1f us\n", (stats->poll_max_ns + stats->react_max_ns) / 1000.0);
+    }
+}
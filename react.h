@@ -0,0 +1,47 @@
+#ifndef react_h
+#define react_h
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sainsmartrelay.h"
+
+/*
+ * Edge rules are compiled into tables indexed by the set of input pins
+ * that rose or fell between two polls, so reacting to any combination
+ * of edges costs four table lookups.
+ */
+typedef struct
+{
+    int num_rules;
+    uint8 input_mask;
+    uint8 rise_on[256];
+    uint8 rise_off[256];
+    uint8 fall_on[256];
+    uint8 fall_off[256];
+}
+react_rules_t;
+
+typedef struct
+{
+    uint64_t polls;
+    uint64_t reactions;         /* edges that changed the outputs */
+    uint64_t rejected;          /* reactions refused by the interlock */
+    uint64_t react_min_ns;      /* edge seen -> output written */
+    uint64_t react_max_ns;
+    uint64_t react_sum_ns;
+    uint64_t poll_max_ns;       /* longest gap between two input samples */
+}
+react_stats_t;
+
+/* Read the pins / write the outputs; return 0 on success */
+typedef int (*react_read_fn)(uint8 *pins, void *ctx);
+typedef int (*react_write_fn)(uint8 data, void *ctx);
+
+int react_parse(react_rules_t *rules, const char *spec, uint8 input_mask, uint8 num_relays);
+int react_run(const react_rules_t *rules, react_read_fn read, react_write_fn write, void *ctx,
+              int cpu, volatile sig_atomic_t *stop, react_stats_t *stats);
+void react_report(const react_stats_t *stats, FILE *out);
+
+#endif
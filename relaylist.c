@@ -0,0 +1,293 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "relaylist.h"
+
+/**********************************************************
+ * Function strsplit()
+ *
+ * Description: Split a given string based on delimiter
+ *
+ * Parameters: str (in) - String to be split
+ *             delim(in)- Delimiter with which the string to be split.
+ *             numtokens(out) - Size of the new response array
+ *
+ * Return:  array - response array
+ *********************************************************/
+char **strsplit(const char* str, const char* delim, size_t* numtokens)
+{
+    // copy the original string so that we don't overwrite parts of it
+    // (don't do this if you don't need to keep the old line,
+    // as this is less efficient)
+    char *s = strdup(str);
+    // these three variables are part of a very common idiom to
+    // implement a dynamically-growing array
+    size_t tokens_alloc = 1;
+    size_t tokens_used = 0;
+    char **tokens = calloc(tokens_alloc, sizeof(char*));
+    char *token, *strtok_ctx;
+    for (token = strtok_r(s, delim, &strtok_ctx);
+            token != NULL;
+            token = strtok_r(NULL, delim, &strtok_ctx))
+    {
+        // check if we need to allocate more space for tokens
+        if (tokens_used == tokens_alloc)
+        {
+            tokens_alloc *= 2;
+            tokens = realloc(tokens, tokens_alloc * sizeof(char*));
+        }
+        tokens[tokens_used++] = strdup(token);
+    }
+    // cleanup
+    if (tokens_used == 0)
+    {
+        free(tokens);
+        tokens = NULL;
+    }
+    else
+    {
+        tokens = realloc(tokens, tokens_used * sizeof(char*));
+    }
+    *numtokens = tokens_used;
+    free(s);
+    return tokens;
+}
+
+
+/**********************************************************
+ * Function compare_int()
+ *
+ * Description: qsort() comparator for int arrays
+ *********************************************************/
+static int compare_int(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/**********************************************************
+ * Function remove_duplicate()
+ *
+ * Description: Remove duplicate elements from input array.
+ *              The input array is left untouched; the result
+ *              is returned in ascending order. Sorting keeps
+ *              this O(n log n) with a single allocation.
+ *
+ * Parameters: array (in) - source array
+ *             length(in)- length of the source array
+ *             numtokens(out) - Size of the new response array
+ *
+ * Return:  array - New array with deduped array content
+ *                  (NULL if length is 0)
+ *********************************************************/
+int *remove_duplicate(int array[],int length, size_t* numtokens)
+{
+    size_t tokens_used = 0;
+    int *tokens;
+    int i;
+
+    *numtokens = 0;
+    if (length <= 0)
+    {
+        return NULL;
+    }
+
+    tokens = malloc(length * sizeof(int));
+    if (tokens == NULL)
+    {
+        return NULL;
+    }
+    memcpy(tokens, array, length * sizeof(int));
+    qsort(tokens, length, sizeof(int), compare_int);
+
+    for (i = 0; i < length; i++)
+    {
+        if (tokens_used == 0 || tokens[tokens_used-1] != tokens[i])
+        {
+            tokens[tokens_used++] = tokens[i];
+        }
+    }
+
+    *numtokens = tokens_used;
+    return tokens;
+}
+
+/**********************************************************
+ * Function get_bits()
+ *
+ * Description: Calculate the relay status from bit information
+ *
+ * Parameters: n (in) - input bit information
+ *             bitwanted(in)- status of relay required
+ *
+ * Return:  array of relay id and it's status
+ *********************************************************/
+int *get_bits(int n, int bitswanted)
+{
+    int *bits = malloc(sizeof(int) * bitswanted);
+
+    int k;
+    for(k=0; k<bitswanted; k++)
+    {
+        int mask =  1 << k;
+        int masked_n = n & mask;
+        int thebit = masked_n >> k;
+        bits[k] = thebit;
+    }
+
+    return bits;
+}
+
+/**********************************************************
+ * Function relay_mask_from_list()
+ *
+ * Description: Build the output bit mask for a comma
+ *              separated list of relay numbers. Relay numbers
+ *              outside FIRST_RELAY..num_relays are ignored.
+ *
+ * Parameters: list (in)       - relay list, e.g. "1,3,4"
+ *             num_relays (in) - number of relays on the card
+ *
+ * Return:  bit mask of the listed relays
+ *********************************************************/
+uint8 relay_mask_from_list(const char *list, uint8 num_relays)
+{
+    char **op_relay_list;
+    size_t numtokens = 0;
+    size_t numtok = 0;
+    size_t i;
+    int *relay_list;
+    int *relays;
+    uint8 mask = 0;
+
+    op_relay_list = strsplit(list, ", \t\n", &numtokens);
+    if (op_relay_list == NULL)
+    {
+        return 0;
+    }
+
+    /* heap, not a VLA: the list length comes from the user */
+    relay_list = malloc(numtokens * sizeof(int));
+    for (i = 0; i < numtokens; i++)
+    {
+        if (relay_list != NULL)
+        {
+            relay_list[i] = atoi(op_relay_list[i]);
+        }
+        free(op_relay_list[i]);
+    }
+    free(op_relay_list);
+    if (relay_list == NULL)
+    {
+        return 0;
+    }
+
+    relays = remove_duplicate(relay_list, numtokens, &numtok);
+    free(relay_list);
+    for (i = 0; i < numtok; i++)
+    {
+        if (relays[i] >= FIRST_RELAY && relays[i] <= (FIRST_RELAY+num_relays-1))
+        {
+            mask |= (0x01<<(relays[i]-1));
+        }
+    }
+    free(relays);
+    return mask;
+}
+
+/**********************************************************
+ * Function relay_list_parse()
+ *
+ * Description: Strict counterpart of relay_mask_from_list() for
+ *              input that must not be guessed at: "all" or relay
+ *              numbers separated by commas or white space, every
+ *              one of them on the card
+ *
+ * Parameters: list (in)       - relay list, e.g. "1,3,4" or "all"
+ *             num_relays (in) - number of relays on the card
+ *             mask (out)      - bit mask of the listed relays
+ *
+ * Return:  0 - success, -1 - empty list, bad number or relay
+ *              not on the card
+ *********************************************************/
+int relay_list_parse(const char *list, uint8 num_relays, uint8 *mask)
+{
+    const char *p = list;
+    int count = 0;
+
+    *mask = 0;
+    if (strcasecmp(list, "all") == 0)
+    {
+        *mask = relay_mask_all(num_relays);
+        return 0;
+    }
+    for (;;)
+    {
+        char *end;
+        long relay;
+
+        p += strspn(p, ", \t\n");
+        if (*p == '\0')
+        {
+            return (count > 0) ? 0 : -1;
+        }
+        if (!isdigit((unsigned char)*p))
+        {
+            return -1;
+        }
+        relay = strtol(p, &end, 10);
+        if (relay < FIRST_RELAY || relay > (FIRST_RELAY+num_relays-1) ||
+            (*end != '\0' && strchr(", \t\n", *end) == NULL))
+        {
+            return -1;
+        }
+        *mask |= (0x01<<(relay-1));
+        count++;
+        p = end;
+    }
+}
+
+/**********************************************************
+ * Function relay_mask_all()
+ *
+ * Description: Bit mask covering every relay on the card
+ *
+ * Parameters: num_relays (in) - number of relays on the card
+ *
+ * Return:  bit mask of all relays
+ *********************************************************/
+uint8 relay_mask_all(uint8 num_relays)
+{
+    return (uint8)((1u << num_relays) - 1);
+}
+
+/**********************************************************
+ * Function expand_device_selector()
+ *
+ * Description: Turn a device selector given on the command line
+ *              into a libftdi description string. "s:SERIAL" is
+ *              expanded with the Sainsmart vendor/product id;
+ *              "d:BUS/DEV", "i:..." and full "s:VID:PID:SERIAL"
+ *              strings are passed through unchanged.
+ *
+ * Parameters: selector (in) - device selector
+ *
+ * Return:  libftdi description string
+ *********************************************************/
+char *expand_device_selector(const char *selector)
+{
+    char *desc;
+
+    if (strncmp(selector, "s:", 2) == 0 && strchr(selector + 2, ':') == NULL)
+    {
+        size_t len = strlen(selector) + 32;
+        desc = malloc(len);
+        snprintf(desc, len, "s:0x%04x:0x%04x:%s", VENDOR_ID, DEVICE_ID, selector + 2);
+        return desc;
+    }
+    return strdup(selector);
+}
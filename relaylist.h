@@ -0,0 +1,20 @@
+#ifndef relaylist_h
+#define relaylist_h
+
+#include <stddef.h>
+
+#include "sainsmartrelay.h"
+
+/*
+ * Relay list parsing, mask arithmetic and device selectors. Kept apart
+ * from the libftdi code so the bench and test targets can link it alone.
+ */
+char **strsplit(const char* str, const char* delim, size_t* numtokens);
+int *remove_duplicate(int array[],int length, size_t* numtokens);
+int *get_bits(int n, int bitswanted);
+uint8 relay_mask_from_list(const char *list, uint8 num_relays);
+int relay_list_parse(const char *list, uint8 num_relays, uint8 *mask);
+uint8 relay_mask_all(uint8 num_relays);
+char *expand_device_selector(const char *selector);
+
+#endif
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "rtqueue.h"
+
+/**********************************************************
+ * Function rtq_drain()
+ *
+ * Description: Fold every pending intent into the shadow mask
+ *              and write the result once. completed_seq only
+ *              advances when the write succeeds; a failed write
+ *              discards its intents and is recorded in the
+ *              failure counters instead.
+ *
+ * Return:  number of intents consumed
+ *********************************************************/
+static unsigned int rtq_drain(rtq_t *q)
+{
+    unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_acquire);
+    unsigned int count = head - tail;
+    uint32_t last_seq = 0;
+    uint8 next = q->state;
+    int ret;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    for (; tail != head; tail++)
+    {
+        const rtq_intent_t *intent = &q->ring[tail & (RTQ_CAPACITY-1)];
+        next = (next | intent->set_mask) & ~intent->clear_mask;
+        last_seq = intent->seq;
+    }
+    atomic_store_explicit(&q->tail, tail, memory_order_release);
+
+    ret = 0;
+    if (next != q->state)
+    {
+        ret = q->write(next, q->ctx);
+        atomic_fetch_add_explicit(&q->writes, 1, memory_order_relaxed);
+        if (ret == 0)
+        {
+            q->state = next;
+        }
+    }
+    atomic_fetch_add_explicit(&q->merged, count - 1, memory_order_relaxed);
+    atomic_store_explicit(&q->last_status, ret, memory_order_relaxed);
+    if (ret == 0)
+    {
+        atomic_store_explicit(&q->completed_seq, last_seq, memory_order_release);
+    }
+    else
+    {
+        atomic_fetch_add_explicit(&q->failures, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&q->failed_intents, count, memory_order_relaxed);
+        atomic_store_explicit(&q->failed_status, ret, memory_order_relaxed);
+        atomic_store_explicit(&q->failed_seq, last_seq, memory_order_release);
+    }
+    return count;
+}
+
+static void *rtq_thread(void *arg)
+{
+    rtq_t *q = arg;
+
+    while (atomic_load(&q->running))
+    {
+        while (sem_wait(&q->wake) != 0 && errno == EINTR)
+        {
+        }
+        rtq_drain(q);
+    }
+
+    /* Flush whatever was enqueued before the stop request */
+    while (rtq_drain(q) != 0)
+    {
+    }
+    return NULL;
+}
+
+/**********************************************************
+ * Function rtq_start()
+ *
+ * Description: Initialise the queue and start its I/O thread
+ *
+ * Parameters: q (out)     - queue
+ *             state (in)  - current output mask of the card
+ *             write (in)  - writes a new output mask, returns 0 on success
+ *             ctx (in)    - passed to write
+ *
+ * Return:    0 - success
+ *           -1 - fail, thread could not be started
+ *********************************************************/
+int rtq_start(rtq_t *q, uint8 state, rtq_write_fn write, void *ctx)
+{
+    memset(q, 0, sizeof(*q));
+    q->state = state;
+    q->write = write;
+    q->ctx = ctx;
+    atomic_store(&q->running, 1);
+
+    if (sem_init(&q->wake, 0, 0) != 0)
+    {
+        return -1;
+    }
+    if (pthread_create(&q->thread, NULL, rtq_thread, q) != 0)
+    {
+        sem_destroy(&q->wake);
+        return -1;
+    }
+    return 0;
+}
+
+/**********************************************************
+ * Function rtq_enqueue()
+ *
+ * Description: Queue a mask intent. Must only be called from
+ *              one producer at a time. Never blocks or allocates
+ *              and sem_post is async-signal-safe, so a signal
+ *              handler may call it only if it is the sole
+ *              producer: an enqueue it interrupts on the same
+ *              ring would corrupt the slot being filled.
+ *
+ * Parameters: q (in)          - queue
+ *             set_mask (in)   - relays to switch on
+ *             clear_mask (in) - relays to switch off (wins over set_mask)
+ *
+ * Return:  > 0 - sequence number to compare with rtq_completed()
+ *           -1 - fail, ring full (counted as overflow)
+ *********************************************************/
+int64_t rtq_enqueue(rtq_t *q, uint8 set_mask, uint8 clear_mask)
+{
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned int depth = head - atomic_load_explicit(&q->tail, memory_order_acquire);
+    rtq_intent_t *intent;
+
+    if (depth == RTQ_CAPACITY)
+    {
+        atomic_fetch_add_explicit(&q->overflows, 1, memory_order_relaxed);
+        return -1;
+    }
+
+    intent = &q->ring[head & (RTQ_CAPACITY-1)];
+    intent->set_mask = set_mask;
+    intent->clear_mask = clear_mask;
+    intent->seq = ++q->next_seq;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    atomic_fetch_add_explicit(&q->enqueued, 1, memory_order_relaxed);
+    if (depth + 1 > atomic_load_explicit(&q->max_depth, memory_order_relaxed))
+    {
+        atomic_store_explicit(&q->max_depth, depth + 1, memory_order_relaxed);
+    }
+    sem_post(&q->wake);
+    return intent->seq;
+}
+
+/**********************************************************
+ * Function rtq_completed()
+ *
+ * Description: Sequence number of the last intent written to
+ *              the card, and optionally the result of the most
+ *              recent write, successful or not
+ *********************************************************/
+uint32_t rtq_completed(rtq_t *q, int *status)
+{
+    uint32_t seq = atomic_load_explicit(&q->completed_seq, memory_order_acquire);
+
+    if (status != NULL)
+    {
+        *status = atomic_load_explicit(&q->last_status, memory_order_relaxed);
+    }
+    return seq;
+}
+
+/**********************************************************
+ * Function rtq_stats()
+ *
+ * Description: Lock-free snapshot of the queue counters
+ *********************************************************/
+void rtq_stats(rtq_t *q, rtq_stats_t *stats)
+{
+    stats->enqueued = atomic_load_explicit(&q->enqueued, memory_order_relaxed);
+    stats->overflows = atomic_load_explicit(&q->overflows, memory_order_relaxed);
+    stats->writes = atomic_load_explicit(&q->writes, memory_order_relaxed);
+    stats->merged = atomic_load_explicit(&q->merged, memory_order_relaxed);
+    stats->depth = atomic_load_explicit(&q->head, memory_order_relaxed) -
+                   atomic_load_explicit(&q->tail, memory_order_relaxed);
+    stats->max_depth = atomic_load_explicit(&q->max_depth, memory_order_relaxed);
+    stats->completed_seq = rtq_completed(q, &stats->last_status);
+    stats->failures = atomic_load_explicit(&q->failures, memory_order_relaxed);
+    stats->failed_intents = atomic_load_explicit(&q->failed_intents, memory_order_relaxed);
+    stats->failed_seq = atomic_load_explicit(&q->failed_seq, memory_order_acquire);
+    stats->failed_status = atomic_load_explicit(&q->failed_status, memory_order_relaxed);
+}
+
+/**********************************************************
+ * Function rtq_stop()
+ *
+ * Description: Write any pending intents and stop the I/O thread
+ *********************************************************/
+void rtq_stop(rtq_t *q)
+{
+    atomic_store(&q->running, 0);
+    sem_post(&q->wake);
+    pthread_join(q->thread, NULL);
+    sem_destroy(&q->wake);
+}
@@ -0,0 +1,85 @@
+#ifndef rtqueue_h
+#define rtqueue_h
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "sainsmartrelay.h"
+
+#define RTQ_CAPACITY 256    /* must be a power of two */
+
+/*
+ * Real-time safe relay commands. One producer thread enqueues mask
+ * intents into a fixed single-producer/single-consumer ring; a
+ * dedicated I/O thread drains it, folds all pending intents into one
+ * output mask and writes that to the card. Enqueueing never allocates,
+ * locks or blocks, and the counters can be read lock-free from any
+ * thread. When a write fails the intents folded into it are discarded,
+ * the outputs keep their last written state and the failure is counted;
+ * an intent took effect only if completed_seq reached it and no failure
+ * counted it.
+ */
+typedef struct
+{
+    uint8 set_mask;
+    uint8 clear_mask;
+    uint32_t seq;
+}
+rtq_intent_t;
+
+typedef int (*rtq_write_fn)(uint8 data, void *ctx);
+
+typedef struct
+{
+    uint64_t enqueued;
+    uint64_t overflows;         /* intents refused because the ring was full */
+    uint64_t writes;            /* writes issued by the I/O thread */
+    uint64_t merged;            /* intents folded into another intent's write */
+    uint32_t depth;             /* intents waiting right now */
+    uint32_t max_depth;
+    uint32_t completed_seq;     /* last intent that reached the card */
+    int last_status;            /* result of the last write */
+    uint64_t failures;          /* writes that failed (sticky) */
+    uint64_t failed_intents;    /* intents discarded by failed writes */
+    uint32_t failed_seq;        /* last intent discarded by a failed write */
+    int failed_status;          /* result of the last failed write */
+}
+rtq_stats_t;
+
+typedef struct
+{
+    rtq_intent_t ring[RTQ_CAPACITY];
+    atomic_uint head;           /* written by the producer only */
+    atomic_uint tail;           /* written by the I/O thread only */
+    uint32_t next_seq;          /* producer private */
+
+    atomic_uint completed_seq;
+    atomic_int last_status;
+    atomic_ullong failures;
+    atomic_ullong failed_intents;
+    atomic_uint failed_seq;
+    atomic_int failed_status;
+    atomic_ullong enqueued;
+    atomic_ullong overflows;
+    atomic_ullong writes;
+    atomic_ullong merged;
+    atomic_uint max_depth;
+
+    atomic_int running;
+    sem_t wake;
+    pthread_t thread;
+    rtq_write_fn write;
+    void *ctx;
+    uint8 state;                /* I/O thread private shadow of the outputs */
+}
+rtq_t;
+
+int rtq_start(rtq_t *q, uint8 state, rtq_write_fn write, void *ctx);
+int64_t rtq_enqueue(rtq_t *q, uint8 set_mask, uint8 clear_mask);
+uint32_t rtq_completed(rtq_t *q, int *status);
+void rtq_stats(rtq_t *q, rtq_stats_t *stats);
+void rtq_stop(rtq_t *q);
+
+#endif
@@ -3,15 +3,36 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <ftdi.h>
 #include <getopt.h>
 #include <ctype.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include "sainsmartrelay.h"
+#include "interlock.h"
+#include "relaylist.h"
+#include "capture.h"
+#include "trace.h"
+#include "sequence.h"
+#include "react.h"
+#include "fleet.h"
+#include "rtqueue.h"
+#include "estop.h"
 
 
 static struct ftdi_context *ftdi;
 static uint8 g_num_relays=MAX_NUM_RELAYS;
+static interlock_t g_interlock;
+static uint8 g_direction_mask=0xFF;
+static volatile sig_atomic_t g_stop=0;
+static const char *g_device_selector=NULL;
+static int g_device_open=0;
+static int g_watchdog_sec=0;
 
 static void usage(char *myName)
 {
@@ -20,6 +41,15 @@ static void usage(char *myName)
     fprintf(stderr, "  %s --off [1|2|3|4|all]\n", myName);
     fprintf(stderr, "  %s --status [1|2|3|4|all]\n", myName);
     fprintf(stderr, "  %s --findall\n", myName);
+    fprintf(stderr, "  %s --fleet [table|json]\n", myName);
+    fprintf(stderr, "  %s --interlock RULES --on|--off ...\n", myName);
+    fprintf(stderr, "  %s --inputs MASK --capture FILE [--rate HZ] [--samples N]\n", myName);
+    fprintf(stderr, "  %s --trace FILE ...\n", myName);
+    fprintf(stderr, "  %s --device [s:SERIAL|d:BUS/DEV] ...\n", myName);
+    fprintf(stderr, "  %s --sequence FILE\n", myName);
+    fprintf(stderr, "  %s --inputs MASK --react RULES [--cpu N]\n", myName);
+    fprintf(stderr, "  %s --serve [--watchdog SEC]\n", myName);
+    fprintf(stderr, "  %s --estop | --estop-test N\n", myName);
     fprintf(stderr, "  %s -h\n", myName);
 }
 
@@ -31,6 +61,31 @@ static void help(char *myName)
     fprintf(stdout, "  --off | -f [1|2|3|4|all]  switch specified relay output off.This argument also allows comma seperated relay numbers.\n");
     fprintf(stdout, "  --status | -s [1|2|3|4|all] get the relay status.\n");
     fprintf(stdout, "  --findall | -a find all the FTDI device connected to the system.\n");
+    fprintf(stdout, "  --fleet | -F [table|json] probe all connected relay cards in parallel and print their strings,\n");
+    fprintf(stdout, "                          chip type, chip ID and pin state as a table or JSON document.\n");
+    fprintf(stdout, "  --interlock | -i RULES  reject relay states forbidden by RULES, e.g. \"1+2,3+4\" never switches\n");
+    fprintf(stdout, "                          relays 1 and 2 (or 3 and 4) on together. Defaults to $%s.\n", INTERLOCK_ENV);
+    fprintf(stdout, "  --inputs | -n MASK  configure the pins in hex MASK as inputs, e.g. 0xF0 on the 4 channel card.\n");
+    fprintf(stdout, "  --capture | -c FILE  sample the input pins and write them run-length encoded to FILE.\n");
+    fprintf(stdout, "  --rate | -r HZ  capture sample rate (default %d).\n", CAPTURE_DEFAULT_RATE);
+    fprintf(stdout, "  --samples | -N N  stop the capture after N samples (default: until interrupted).\n");
+    fprintf(stdout, "  --trace | -t FILE  record every USB operation to a binary trace FILE. Defaults to $%s.\n", TRACE_ENV);
+    fprintf(stdout, "  --device | -d [s:SERIAL|d:BUS/DEV]  use the card with the given serial number or bus/device\n");
+    fprintf(stdout, "                          numbers (see lsusb) instead of the first one found. Defaults to $%s.\n", DEVICE_ENV);
+    fprintf(stdout, "  --sequence | -q FILE  run the relay sequence in FILE (set/clear/mask/wait/label/repeat) and\n");
+    fprintf(stdout, "                          report how late each wait step woke up.\n");
+    fprintf(stdout, "  --react | -e RULES  poll the input pins and switch relays on input edges until interrupted.\n");
+    fprintf(stdout, "                          RULES are PIN:EDGE=ACTION:RELAYS separated by ';', e.g. \"5:rise=off:1\"\n");
+    fprintf(stdout, "                          opens relay 1 when input pin 5 goes high. EDGE is rise|fall|any, ACTION on|off.\n");
+    fprintf(stdout, "  --cpu | -u N  pin the --react polling thread to CPU N.\n");
+    fprintf(stdout, "  --serve | -S  read 'on LIST', 'off LIST', 'mask HEX' and 'stats' commands from stdin and queue\n");
+    fprintf(stdout, "                          them to a background writer thread until end of input.\n");
+    fprintf(stdout, "  --watchdog | -w SEC  with --serve, switch every relay off if no command (or 'ping') arrives\n");
+    fprintf(stdout, "                          for SEC seconds.\n");
+    fprintf(stdout, "  --estop | -E  emergency stop: switch every relay off without reading the card first.\n");
+    fprintf(stdout, "  --estop-test | -T N  trigger the emergency stop N times and report its latency. Relays that are\n");
+    fprintf(stdout, "                          on are kept being rewritten meanwhile, and checked to be off after each trigger.\n");
+    fprintf(stdout, "  While --capture, --sequence, --react or --serve run, SIGUSR1 triggers the emergency stop.\n");
 }
 
 static void checkPermission()
@@ -46,146 +101,58 @@ static void checkPermission()
 
 
 /**********************************************************
- * Function strsplit()
+ * Function relay_open()
  *
- * Description: Split a given string based on delimiter
+ * Description: Open the relay card once per command. Later
+ *              calls reuse the open handle instead of walking
+ *              the USB device list again. With a device selector
+ *              the card is opened through ftdi_usb_open_string(),
+ *              otherwise the first card with the Sainsmart
+ *              vendor/product id is used.
  *
- * Parameters: str (in) - String to be split
- *             delim(in)- Delimiter with which the string to be split.
- *             numtokens(out) - Size of the new response array
- *
- * Return:  array - response array
- *********************************************************/
-char **strsplit(const char* str, const char* delim, size_t* numtokens)
-{
-    // copy the original string so that we don't overwrite parts of it
-    // (don't do this if you don't need to keep the old line,
-    // as this is less efficient)
-    char *s = strdup(str);
-    // these three variables are part of a very common idiom to
-    // implement a dynamically-growing array
-    size_t tokens_alloc = 1;
-    size_t tokens_used = 0;
-    char **tokens = calloc(tokens_alloc, sizeof(char*));
-    char *token, *strtok_ctx;
-    for (token = strtok_r(s, delim, &strtok_ctx);
-            token != NULL;
-            token = strtok_r(NULL, delim, &strtok_ctx))
-    {
-        // check if we need to allocate more space for tokens
-        if (tokens_used == tokens_alloc)
-        {
-            tokens_alloc *= 2;
-            tokens = realloc(tokens, tokens_alloc * sizeof(char*));
-        }
-        tokens[tokens_used++] = strdup(token);
-    }
-    // cleanup
-    if (tokens_used == 0)
-    {
-        free(tokens);
-        tokens = NULL;
-    }
-    else
-    {
-        tokens = realloc(tokens, tokens_used * sizeof(char*));
-    }
-    *numtokens = tokens_used;
-    free(s);
-    return tokens;
-}
-
-
-/**********************************************************
- * Function remove_duplicate()
- *
- * Description: Remove duplicate elements from input array
- *
- * Parameters: array (in) - source array
- *             length(in)- length of the source array
- *             numtokens(out) - Size of the new response array
- *
- * Return:  array - New array with deduped array content
+ * Return:    0 - success
+ *           -1 - fail, device could not be opened
  *********************************************************/
-int *remove_duplicate(int array[],int length, size_t* numtokens)
+int relay_open(void)
 {
-    size_t tokens_alloc = 1;
-    size_t tokens_used = 0;
-    int *tokens = calloc(tokens_alloc, sizeof(int*));
-
-    int *current , *end = array + length - 1;
-    int flag = 0;
-    for ( current = array + 1; array < end; array++, current = array + 1 )
-    {
-        flag = 0;
-        while ( current <= end )
-        {
-            if ( *current == *array )
-            {
-                *current = *end--;
-
-            }
-            else
-            {
-                flag = 1;
-                current++;
-            }
-        }
-        if(flag == 1)
-        {
-            if (tokens_used == tokens_alloc)
-            {
-                tokens_alloc *= 1;
-                tokens = realloc(tokens, tokens_alloc * sizeof(int*));
-            }
+    int ret;
 
-            tokens[tokens_used++] = *array;
-        }
-    }
-    if (tokens_used == tokens_alloc)
+    if (g_device_open)
     {
-        tokens_alloc *= 1;
-        tokens = realloc(tokens, tokens_alloc * sizeof(int*));
+        return 0;
     }
 
-    tokens[tokens_used++] = *array;
-    if (tokens_used == 0)
+    if (g_device_selector != NULL)
     {
-        free(tokens);
-        tokens = NULL;
+        ret = traced_usb_open_string(ftdi, g_device_selector);
     }
     else
     {
-        tokens = realloc(tokens, tokens_used * sizeof(int*));
+        ret = traced_usb_open(ftdi, VENDOR_ID, DEVICE_ID);
     }
-    *numtokens = tokens_used;
-    return tokens;
+    if (ret < 0)
+    {
+        fprintf(stderr, "unable to open ftdi device: (%s)\n", ftdi_get_error_string(ftdi));
+        return -1;
+    }
+
+    g_device_open = 1;
+    return 0;
 }
 
 /**********************************************************
- * Function get_bits()
- *
- * Description: Calculate the relay status from bit information
+ * Function relay_close()
  *
- * Parameters: n (in) - input bit information
- *             bitwanted(in)- status of relay required
- *
- * Return:  array of relay id and it's status
+ * Description: Close the relay card if it is open
  *********************************************************/
-int *get_bits(int n, int bitswanted)
+void relay_close(void)
 {
-    int *bits = malloc(sizeof(int) * bitswanted);
-
-    int k;
-    for(k=0; k<bitswanted; k++)
+    if (g_device_open)
     {
-        int mask =  1 << k;
-        int masked_n = n & mask;
-        int thebit = masked_n >> k;
-        bits[k] = thebit;
+        estop_disarm();
+        traced_usb_close(ftdi);
+        g_device_open = 0;
     }
-
-    return bits;
 }
 
 /**********************************************************
@@ -212,17 +179,18 @@ int detect_relay_card_sainsmart_4_8chan(char* portname, uint8* num_relays)
     }
 
     /* Try to open FTDI USB device */
-    if ((ftdi_usb_open(ftdi, VENDOR_ID, DEVICE_ID)) < 0)
+    if (relay_open() < 0)
     {
         ftdi_free(ftdi);
+        ftdi = NULL;
         return -1;
     }
 
     /* Set FTDI chip to bitbang mode */
-    if (ftdi_set_bitmode(ftdi, 0xFF, BITMODE_BITBANG) < 0)
+    if (traced_set_bitmode(ftdi, g_direction_mask, BITMODE_BITBANG) < 0)
     {
         fprintf(stderr, "unable to set bitbang mode: (%s)\n", ftdi_get_error_string(ftdi));
-        ftdi_free(ftdi);
+        relay_close();
         return -1;
     }
 
@@ -233,19 +201,20 @@ int detect_relay_card_sainsmart_4_8chan(char* portname, uint8* num_relays)
     if (ftdi->type != 5000 && ftdi->type != TYPE_R )
     {
         fprintf(stderr, "unable to continue, not an R-type chip\n");
-        ftdi_free(ftdi);
+        relay_close();
         return -1;
     }
 
     /* Read out FTDI Chip-ID of R type chips */
-    ftdi_read_chipid(ftdi, &chipid);
+    traced_read_chipid(ftdi, &chipid);
 
     /* Return parameters */
     if (num_relays!=NULL) *num_relays = g_num_relays;
     sprintf(portname, "FTDI chipid %X", chipid);
     //printf("DBG: portname %s\n", portname);
 
-    ftdi_usb_close(ftdi);
+    /* Keep the device open for the remaining operations of this command */
+    atexit(relay_close);
     return 0;
 }
 
@@ -288,20 +257,42 @@ int find_device(void)
         printf("Checking device: %d\n", i);
         if ((ret = ftdi_usb_get_strings(ftdi, curdev->dev, manufacturer, 128, description, 128, NULL, 0)) < 0)
         {
+            /* Report the failing device and carry on with the rest */
             fprintf(stderr, "ftdi_usb_get_strings failed: %d (%s)\n", ret, ftdi_get_error_string(ftdi));
             retval = EXIT_FAILURE;
-            goto done;
         }
-        printf("Manufacturer: %s, Description: %s\n", manufacturer, description);
+        else
+        {
+            printf("Manufacturer: %s, Description: %s\n", manufacturer, description);
+        }
         curdev = curdev->next;
     }
-done:
     ftdi_list_free(&devlist);
 do_deinit:
     ftdi_free(ftdi);
     return retval;
 }
 
+/**********************************************************
+ * Function read_relay_pins()
+ *
+ * Description: Read the pin state of the open card, holding the
+ *              card I/O lock against the emergency stop thread
+ *
+ * Parameters: pins (out) - pin state
+ *
+ * Return:  result of ftdi_read_pins()
+ *********************************************************/
+static int read_relay_pins(unsigned char *pins)
+{
+    int ret;
+
+    estop_io_lock();
+    ret = traced_read_pins(ftdi, pins);
+    estop_io_unlock();
+    return ret;
+}
+
 /**********************************************************
  * Function get_relay_sainsmart_4_8chan()
  *
@@ -324,15 +315,13 @@ int get_relay_sainsmart_4_8chan(uint8 relay, relay_state_t* relay_state)
     }
 
     /* Open FTDI USB device */
-    if ((ftdi_usb_open(ftdi, VENDOR_ID, DEVICE_ID)) < 0)
+    if (relay_open() < 0)
     {
-        fprintf(stderr, "unable to open ftdi device: (%s)\n", ftdi_get_error_string(ftdi));
-        ftdi_free(ftdi);
         return -2;
     }
 
     /* Get relay state from the card */
-    if (ftdi_read_pins(ftdi, &buf[0]) < 0)
+    if (read_relay_pins(&buf[0]) < 0)
     {
         fprintf(stderr,"read failed for 0x%x, error %s\n",buf[0], ftdi_get_error_string(ftdi));
         return -3;
@@ -342,8 +331,8 @@ int get_relay_sainsmart_4_8chan(uint8 relay, relay_state_t* relay_state)
 
     relay = relay-1;
     *relay_state = (bits[relay] > 0) ? ON : OFF;
+    free(bits);
 
-    ftdi_usb_close(ftdi);
     return 0;
 }
 
@@ -362,15 +351,13 @@ int get_relay_sainsmart_4_8chan_all(int *relay_states)
     unsigned char buf[1];
 
     /* Open FTDI USB device */
-    if ((ftdi_usb_open(ftdi, VENDOR_ID, DEVICE_ID)) < 0)
+    if (relay_open() < 0)
     {
-        fprintf(stderr, "unable to open ftdi device: (%s)\n", ftdi_get_error_string(ftdi));
-        ftdi_free(ftdi);
         return -2;
     }
 
     /* Get relay state from the card */
-    if (ftdi_read_pins(ftdi, &buf[0]) < 0)
+    if (read_relay_pins(&buf[0]) < 0)
     {
         fprintf(stderr,"read failed for 0x%x, error %s\n",buf[0], ftdi_get_error_string(ftdi));
         return -3;
@@ -383,7 +370,7 @@ int get_relay_sainsmart_4_8chan_all(int *relay_states)
     {
         relay_states[j]= bits[j];
     }
-    ftdi_usb_close(ftdi);
+    free(bits);
     return 0;
 }
 
@@ -402,15 +389,13 @@ int get_relay_sainsmart_4_8chan_raw(uint8 *relay_data)
     unsigned char buf[1];
 
     /* Open FTDI USB device */
-    if ((ftdi_usb_open(ftdi, VENDOR_ID, DEVICE_ID)) < 0)
+    if (relay_open() < 0)
     {
-        fprintf(stderr, "unable to open ftdi device: (%s)\n", ftdi_get_error_string(ftdi));
-        ftdi_free(ftdi);
         return -2;
     }
 
     /* Get relay state from the card */
-    if (ftdi_read_pins(ftdi, &buf[0]) < 0)
+    if (read_relay_pins(&buf[0]) < 0)
     {
         fprintf(stderr,"read failed for 0x%x, error %s\n",buf[0], ftdi_get_error_string(ftdi));
         return -3;
@@ -418,9 +403,55 @@ int get_relay_sainsmart_4_8chan_raw(uint8 *relay_data)
     *relay_data = buf[0];
     //printf("DBG: Read GPIO bits %02X\n", buf[0]);
 
-    ftdi_usb_close(ftdi);
     return 0;
 }
+/**********************************************************
+ * Function write_relay_data()
+ *
+ * Description: Write a new output mask to the opened card after
+ *              checking it against the interlock rules. Once the
+ *              emergency stop is latched nothing more is written.
+ *
+ * Parameters: relay_data (in) - new output mask
+ *
+ * Return:    0 - success
+ *           -4 - fail, write error
+ * RELAY_ERR_INTERLOCK - fail, rejected by an interlock rule
+ *     RELAY_ERR_ESTOP - fail, the emergency stop was triggered
+ *********************************************************/
+static int write_relay_data(uint8 relay_data)
+{
+    unsigned char buf[1];
+    char rule_str[32];
+    int rule, ret;
+
+    if ((rule = interlock_check(&g_interlock, relay_data)) != 0)
+    {
+        fprintf(stderr, "ERROR: relay state 0x%02X rejected by interlock rule %d (%s)\n",
+                relay_data, rule, interlock_rule_string(&g_interlock, rule, rule_str, sizeof(rule_str)));
+        return RELAY_ERR_INTERLOCK;
+    }
+
+    /* Checked under the lock the stop thread writes under, so the
+     * all-off write can only come after this one, never before */
+    estop_io_lock();
+    if (estop_latched())
+    {
+        estop_io_unlock();
+        fprintf(stderr, "ERROR: emergency stop triggered, relay state 0x%02X not written\n", relay_data);
+        return RELAY_ERR_ESTOP;
+    }
+    buf[0] = relay_data;
+    ret = traced_write(ftdi, buf, 1);
+    estop_io_unlock();
+    if (ret < 0)
+    {
+        fprintf(stderr,"write failed for 0x%x, error %s\n",buf[0], ftdi_get_error_string(ftdi));
+        return -4;
+    }
+    return 0;
+}
+
 /**********************************************************
  * Function set_relay_sainsmart_4_8chan()
  *
@@ -435,6 +466,7 @@ int get_relay_sainsmart_4_8chan_raw(uint8 *relay_data)
 int set_relay_sainsmart_4_8chan(uint8 relay, relay_state_t relay_state)
 {
     unsigned char buf[1];
+    int ret;
 
     if (relay<FIRST_RELAY || relay>(FIRST_RELAY+g_num_relays-1))
     {
@@ -443,15 +475,13 @@ int set_relay_sainsmart_4_8chan(uint8 relay, relay_state_t relay_state)
     }
 
     /* Open FTDI USB device */
-    if ((ftdi_usb_open(ftdi, VENDOR_ID, DEVICE_ID)) < 0)
+    if (relay_open() < 0)
     {
-        fprintf(stderr, "unable to open ftdi device: (%s)\n", ftdi_get_error_string(ftdi));
-        ftdi_free(ftdi);
         return -2;
     }
 
     /* Get relay state from the card */
-    if (ftdi_read_pins(ftdi, buf) < 0)
+    if (read_relay_pins(buf) < 0)
     {
         fprintf(stderr,"read failed for 0x%x, error %s\n",buf[0], ftdi_get_error_string(ftdi));
         return -3;
@@ -473,13 +503,11 @@ int set_relay_sainsmart_4_8chan(uint8 relay, relay_state_t relay_state)
     //printf("DBG: Writing GPIO bits %02X\n", buf[0]);
 
     /* Set relay on the card */
-    if (ftdi_write_data(ftdi, buf, 1) < 0)
+    if ((ret = write_relay_data(buf[0])) < 0)
     {
-        fprintf(stderr,"read failed for 0x%x, error %s\n",buf[0], ftdi_get_error_string(ftdi));
-        return -4;
+        return ret;
     }
 
-    ftdi_usb_close(ftdi);
     return 0;
 }
 
@@ -496,55 +524,46 @@ int set_relay_sainsmart_4_8chan(uint8 relay, relay_state_t relay_state)
 int set_relay_sainsmart_4_8chan_all(relay_state_t relay_state)
 {
     unsigned char buf[1];
-    int i;
+    int ret;
 
     /* Open FTDI USB device */
-    if ((ftdi_usb_open(ftdi, VENDOR_ID, DEVICE_ID)) < 0)
+    if (relay_open() < 0)
     {
-        fprintf(stderr, "unable to open ftdi device: (%s)\n", ftdi_get_error_string(ftdi));
-        ftdi_free(ftdi);
         return -2;
     }
 
     /* Get relay state from the card */
-    if (ftdi_read_pins(ftdi, buf) < 0)
+    if (read_relay_pins(buf) < 0)
     {
         fprintf(stderr,"read failed for 0x%x, error %s\n",buf[0], ftdi_get_error_string(ftdi));
-        return -3;
+        if (relay_state != OFF)
+        {
+            return -3;
+        }
+        /* Switching everything off must not depend on the read */
+        buf[0] = 0;
     }
 
     /* Set the new relay state bit */
     if (relay_state == OFF)
     {
         /* Clear all the relay state */
-        //buf[0] = 0x0;
-        for(i=1; i<= g_num_relays; i++)
-        {
-            buf[0] = buf[0] & ~(0x01<<(i-1));
-
-        }
+        buf[0] = buf[0] & ~relay_mask_all(g_num_relays);
     }
     else
     {
         /* Set all the relay state */
-        //buf[0] = 0xFF;
-        for(i=1; i<= g_num_relays; i++)
-        {
-            buf[0] = buf[0] | (0x01<<(i-1));
-
-        }
+        buf[0] = buf[0] | relay_mask_all(g_num_relays);
     }
 
     //printf("DBG: Writing GPIO bits %02X\n", buf[0]);
 
     /* Set relay on the card */
-    if (ftdi_write_data(ftdi, buf, 1) < 0)
+    if ((ret = write_relay_data(buf[0])) < 0)
     {
-        fprintf(stderr,"read failed for 0x%x, error %s\n",buf[0], ftdi_get_error_string(ftdi));
-        return -4;
+        return ret;
     }
 
-    ftdi_usb_close(ftdi);
     return 0;
 }
 
@@ -561,12 +580,11 @@ int set_relay_sainsmart_4_8chan_all(relay_state_t relay_state)
 int set_relay_sainsmart_4_8chan_write(uint8 relay_data)
 {
     unsigned char buf[1];
+    int ret;
 
     /* Open FTDI USB device */
-    if ((ftdi_usb_open(ftdi, VENDOR_ID, DEVICE_ID)) < 0)
+    if (relay_open() < 0)
     {
-        fprintf(stderr, "unable to open ftdi device: (%s)\n", ftdi_get_error_string(ftdi));
-        ftdi_free(ftdi);
         return -2;
     }
 
@@ -576,16 +594,415 @@ int set_relay_sainsmart_4_8chan_write(uint8 relay_data)
     //printf("DBG: Writing GPIO bits %02X\n", buf[0]);
 
     /* Set relay on the card */
-    if (ftdi_write_data(ftdi, buf, 1) < 0)
+    if ((ret = write_relay_data(buf[0])) < 0)
     {
-        fprintf(stderr,"read failed for 0x%x, error %s\n",buf[0], ftdi_get_error_string(ftdi));
-        return -4;
+        return ret;
     }
 
-    ftdi_usb_close(ftdi);
     return 0;
 }
 
+static void estop_handler(int sig)
+{
+    (void)sig;
+    estop_request();
+    g_stop = 1;
+}
+
+/**********************************************************
+ * Function arm_estop_sainsmart_4_8chan()
+ *
+ * Description: Keep the open card ready for an emergency stop
+ *              and let SIGUSR1 trigger it. The all-off byte is
+ *              computed here, keeping the state of the pins that
+ *              are not relays, so the trigger needs no read.
+ *
+ * Return:    0 - success
+ *          < 0 - fail
+ *********************************************************/
+int arm_estop_sainsmart_4_8chan(void)
+{
+    uint8 relay_data;
+
+    if (get_relay_sainsmart_4_8chan_raw(&relay_data) != 0)
+    {
+        relay_data = 0;
+    }
+    if (estop_arm(ftdi, relay_data & ~relay_mask_all(g_num_relays)) != 0)
+    {
+        return -1;
+    }
+    signal(SIGUSR1, estop_handler);
+    return 0;
+}
+
+/*
+ * Load for --estop-test: keep rewriting the relay state through the
+ * normal write path, so triggers land while writes are in flight.
+ */
+typedef struct
+{
+    uint8 relay_data;
+    atomic_int stop;
+    atomic_ulong writes;
+}
+estop_load_t;
+
+static void *estop_load_writer(void *arg)
+{
+    estop_load_t *load = arg;
+
+    while (!atomic_load(&load->stop))
+    {
+        if (estop_latched())
+        {
+            sched_yield();
+            continue;
+        }
+        write_relay_data(load->relay_data);
+        atomic_fetch_add(&load->writes, 1);
+    }
+    return NULL;
+}
+
+/**********************************************************
+ * Function estop_sainsmart_4_8chan()
+ *
+ * Description: Trigger the emergency stop count times and
+ *              report its latency, from the request to the write
+ *              of the stop thread. With with_load set and relays
+ *              on when the test starts, a second thread keeps
+ *              writing that state while the stop fires, and after
+ *              every trigger the outputs are read back to check
+ *              that no racing write switched a relay on again.
+ *
+ * Parameters: count (in)     - number of triggers
+ *             with_load (in) - race the triggers with relay writes
+ *
+ * Return:    0 - success
+ *          < 0 - fail, the outputs could not be switched off
+ *              or were found on after a trigger
+ *********************************************************/
+int estop_sainsmart_4_8chan(int count, int with_load)
+{
+    struct timespec settle = { 0, 2 * ESTOP_WRITE_TIMEOUT_MS * 1000000L };
+    static estop_load_t load;
+    estop_stats_t stats;
+    pthread_t writer;
+    unsigned long found_on = 0;
+    int loaded = 0;
+    uint8 pins;
+    int i, ret = 0;
+
+    if (arm_estop_sainsmart_4_8chan() != 0)
+    {
+        return -2;
+    }
+    if (with_load && get_relay_sainsmart_4_8chan_raw(&load.relay_data) == 0 &&
+            (load.relay_data & relay_mask_all(g_num_relays)) != 0)
+    {
+        loaded = (pthread_create(&writer, NULL, estop_load_writer, &load) == 0);
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (loaded)
+        {
+            /* let the writer get a few writes in before the next trigger */
+            estop_reset();
+            nanosleep(&settle, NULL);
+        }
+        if (estop_trigger() != 0)
+        {
+            ret = -4;
+        }
+        if (loaded)
+        {
+            if (read_relay_pins(&pins) < 0 || (pins & relay_mask_all(g_num_relays)) != 0)
+            {
+                found_on++;
+                ret = -4;
+            }
+        }
+    }
+    if (loaded)
+    {
+        atomic_store(&load.stop, 1);
+        pthread_join(writer, NULL);
+    }
+
+    estop_get_stats(&stats);
+    fprintf(stdout, "emergency stop: %llu triggers, %llu failed, %llu retries\n",
+            (unsigned long long)stats.triggers, (unsigned long long)stats.failures,
+            (unsigned long long)stats.retries);
+    fprintf(stdout, "trigger to outputs off: min %.1f us, avg %.1f us, max %.1f us (bound %d ms)\n",
+            stats.min_ns / 1000.0, stats.sum_ns / 1000.0 / stats.triggers, stats.max_ns / 1000.0,
+            ESTOP_WORST_CASE_MS);
+    if (loaded)
+    {
+        fprintf(stdout, "concurrent writes: %lu, outputs found on after a trigger: %lu\n",
+                atomic_load(&load.writes), found_on);
+    }
+    return ret;
+}
+
+static void stop_handler(int sig)
+{
+    (void)sig;
+    g_stop = 1;
+}
+
+/**********************************************************
+ * Function capture_sainsmart_4_8chan()
+ *
+ * Description: Run a capture of the input pins
+ *
+ * Parameters: cfg (in) - capture configuration
+ *
+ * Return:    0 - success
+ *          < 0 - fail
+ *********************************************************/
+int capture_sainsmart_4_8chan(capture_config_t *cfg)
+{
+    capture_stats_t stats;
+    int ret;
+
+    /* Open FTDI USB device */
+    if (relay_open() < 0)
+    {
+        return -2;
+    }
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    ret = capture_run(ftdi, cfg, &stats, &g_stop);
+    fprintf(stdout, "samples: %llu, dropped: %llu, runs: %llu, bytes: %llu, rate: %u Hz\n",
+            (unsigned long long)stats.samples, (unsigned long long)stats.dropped,
+            (unsigned long long)stats.runs, (unsigned long long)stats.bytes_written, stats.rate);
+
+    return ret;
+}
+
+static int sequence_write(uint8 relay_data, void *ctx)
+{
+    (void)ctx;
+    return write_relay_data(relay_data);
+}
+
+/**********************************************************
+ * Function sequence_sainsmart_4_8chan()
+ *
+ * Description: Compile and run a relay sequence file on the
+ *              open card
+ *
+ * Parameters: path (in) - sequence file
+ *
+ * Return:    0 - success
+ *          < 0 - fail
+ *********************************************************/
+int sequence_sainsmart_4_8chan(const char *path)
+{
+    seq_program_t prog;
+    uint8 relay_data;
+    FILE *fp;
+    int ret;
+
+    if ((fp = fopen(path, "r")) == NULL)
+    {
+        fprintf(stderr, "unable to open sequence file %s\n", path);
+        return -1;
+    }
+    ret = seq_compile(&prog, fp, g_num_relays);
+    fclose(fp);
+    if (ret != 0)
+    {
+        return -1;
+    }
+
+    if ((ret = get_relay_sainsmart_4_8chan_raw(&relay_data)) == 0)
+    {
+        signal(SIGINT, stop_handler);
+        signal(SIGTERM, stop_handler);
+
+        ret = seq_run(&prog, relay_data, sequence_write, NULL, &g_stop);
+        seq_report(&prog, stdout);
+    }
+
+    seq_free(&prog);
+    return ret;
+}
+
+static int react_read(uint8 *pins, void *ctx)
+{
+    (void)ctx;
+    return read_relay_pins(pins) < 0 ? -3 : 0;
+}
+
+static int react_write(uint8 relay_data, void *ctx)
+{
+    (void)ctx;
+    return write_relay_data(relay_data);
+}
+
+/**********************************************************
+ * Function react_sainsmart_4_8chan()
+ *
+ * Description: Switch relays on input edges until interrupted
+ *
+ * Parameters: spec (in) - reaction rules
+ *             cpu (in)  - CPU to pin the polling thread to, -1 for any
+ *
+ * Return:    0 - success
+ *          < 0 - fail
+ *********************************************************/
+int react_sainsmart_4_8chan(const char *spec, int cpu)
+{
+    react_rules_t rules;
+    react_stats_t stats;
+    int ret;
+
+    if (react_parse(&rules, spec, (uint8)~g_direction_mask, g_num_relays) != 0)
+    {
+        return -1;
+    }
+
+    /* Open FTDI USB device */
+    if (relay_open() < 0)
+    {
+        return -2;
+    }
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    ret = react_run(&rules, react_read, react_write, NULL, cpu, &g_stop, &stats);
+    react_report(&stats, stdout);
+    return ret;
+}
+
+static int serve_write(uint8 relay_data, void *ctx)
+{
+    (void)ctx;
+    return write_relay_data(relay_data);
+}
+
+static void print_queue_stats(rtq_t *queue)
+{
+    rtq_stats_t stats;
+
+    rtq_stats(queue, &stats);
+    fprintf(stdout, "enqueued: %llu, overflows: %llu, writes: %llu, merged: %llu, depth: %u, "
+            "max depth: %u, completed: %u, status: %d, failures: %llu, failed intents: %llu, "
+            "failed: %u, failed status: %d\n",
+            (unsigned long long)stats.enqueued, (unsigned long long)stats.overflows,
+            (unsigned long long)stats.writes, (unsigned long long)stats.merged,
+            stats.depth, stats.max_depth, stats.completed_seq, stats.last_status,
+            (unsigned long long)stats.failures, (unsigned long long)stats.failed_intents,
+            stats.failed_seq, stats.failed_status);
+    fflush(stdout);
+}
+
+/**********************************************************
+ * Function serve_sainsmart_4_8chan()
+ *
+ * Description: Queue relay commands read from stdin to the
+ *              real-time command queue until end of input
+ *
+ * Return:    0 - success, every queued write reached the card
+ *          < 0 - fail, or the result of the last failed write
+ *********************************************************/
+int serve_sainsmart_4_8chan(void)
+{
+    static rtq_t queue;
+    rtq_stats_t stats;
+    char line[256];
+    uint8 relay_data;
+
+    if (get_relay_sainsmart_4_8chan_raw(&relay_data) != 0)
+    {
+        return -3;
+    }
+    if (rtq_start(&queue, relay_data, serve_write, NULL) != 0)
+    {
+        fprintf(stderr, "unable to start relay writer thread\n");
+        return -1;
+    }
+
+    /* A controller that goes silent switches everything off */
+    if (g_watchdog_sec > 0)
+    {
+        signal(SIGALRM, estop_handler);
+        alarm(g_watchdog_sec);
+    }
+
+    while (fgets(line, sizeof(line), stdin) != NULL)
+    {
+        char *cmd, *arg, *ctx;
+        uint8 mask;
+
+        if (g_watchdog_sec > 0 && !estop_latched())
+        {
+            alarm(g_watchdog_sec);
+        }
+        if ((cmd = strtok_r(line, " \t\r\n", &ctx)) == NULL || strcasecmp(cmd, "ping") == 0)
+        {
+            continue;
+        }
+        arg = strtok_r(NULL, " \t\r\n", &ctx);
+
+        if (strcasecmp(cmd, "stats") == 0)
+        {
+            print_queue_stats(&queue);
+            continue;
+        }
+        if (arg == NULL)
+        {
+            fprintf(stderr, "'%s' needs an argument\n", cmd);
+            continue;
+        }
+
+        if (strcasecmp(cmd, "on") == 0 || strcasecmp(cmd, "off") == 0)
+        {
+            /* A mistyped list must not silently switch nothing */
+            if (relay_list_parse(arg, g_num_relays, &mask) != 0)
+            {
+                fprintf(stderr, "invalid relay list '%s'\n", arg);
+                continue;
+            }
+            if (strcasecmp(cmd, "on") == 0)
+                rtq_enqueue(&queue, mask, 0);
+            else
+                rtq_enqueue(&queue, 0, mask);
+        }
+        else if (strcasecmp(cmd, "mask") == 0)
+        {
+            unsigned long value;
+            char *end;
+
+            errno = 0;
+            value = strtoul(arg, &end, 16);
+            if (!isxdigit((unsigned char)arg[0]) || errno != 0 || *end != '\0' ||
+                value > relay_mask_all(g_num_relays))
+            {
+                fprintf(stderr, "invalid mask '%s', expected 0..%X\n", arg, relay_mask_all(g_num_relays));
+                continue;
+            }
+            mask = (uint8)value;
+            rtq_enqueue(&queue, mask, relay_mask_all(g_num_relays) & ~mask);
+        }
+        else
+        {
+            fprintf(stderr, "unknown command '%s'\n", cmd);
+        }
+    }
+
+    alarm(0);
+    rtq_stop(&queue);
+    print_queue_stats(&queue);
+    rtq_stats(&queue, &stats);
+    return (stats.failures != 0) ? stats.failed_status : 0;
+}
+
 int main(int argc, char *argv[])
 {
     relay_state_t rstate;
@@ -594,17 +1011,45 @@ int main(int argc, char *argv[])
     int opt;
     int long_index = 0;
     int all_check_flag = 0;
-    char *op_relay_on;
-    char *op_relay_off;
+    char *op_relay_on = NULL;
+    char *op_relay_off = NULL;
+    char *op_status = NULL;
     int opOn = -1,opOff = -1;
+    char *interlock_spec = NULL;
+    char *trace_path = getenv(TRACE_ENV);
+    char *device_selector = getenv(DEVICE_ENV);
+    char *sequence_path = NULL;
+    char *react_spec = NULL;
+    int react_cpu = -1;
+    int serve = 0;
+    int estop_count = 0;
+    int estop_test = 0;
+    unsigned long value;
+    char *end;
+    capture_config_t capture_cfg = { NULL, 0xFF, CAPTURE_DEFAULT_RATE, 0 };
 
     static struct option long_options[] =
     {
         {"help",      no_argument,       0,  'h' },
         {"findall", no_argument,       0,  'a' },
+        {"fleet",    required_argument, 0,  'F' },
         {"on",   required_argument, 0,  'o' },
         {"off",   required_argument, 0,  'f' },
         {"status",   required_argument, 0,  's' },
+        {"interlock", required_argument, 0,  'i' },
+        {"inputs",   required_argument, 0,  'n' },
+        {"capture",  required_argument, 0,  'c' },
+        {"rate",     required_argument, 0,  'r' },
+        {"samples",  required_argument, 0,  'N' },
+        {"trace",    required_argument, 0,  't' },
+        {"device",   required_argument, 0,  'd' },
+        {"sequence", required_argument, 0,  'q' },
+        {"react",    required_argument, 0,  'e' },
+        {"cpu",      required_argument, 0,  'u' },
+        {"serve",    no_argument,       0,  'S' },
+        {"watchdog", required_argument, 0,  'w' },
+        {"estop",    no_argument,       0,  'E' },
+        {"estop-test", required_argument, 0, 'T' },
         {0,           0,                 0,  0   }
     };
     if(argc < 2)
@@ -614,7 +1059,7 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
-    while ((opt = getopt_long(argc, argv,":has:o:f:",
+    while ((opt = getopt_long(argc, argv,":haF:s:o:f:i:n:c:r:N:t:d:q:e:u:Sw:ET:",
                               long_options, &long_index )) != -1)
     {
 
@@ -624,14 +1069,16 @@ int main(int argc, char *argv[])
             find_device();
             exit(EXIT_SUCCESS);
             break;
-        case 'o' :
-            if (detect_relay_card_sainsmart_4_8chan(com_port, &num_relays) == -1)
+        case 'F' :
+            if (strcasecmp(optarg, "json") != 0 && strcasecmp(optarg, "table") != 0)
             {
-                fprintf(stderr,"No compatible device detected.\n");
-                checkPermission();
+                fprintf(stderr, "invalid value is set to --fleet argument\n");
                 exit(EXIT_FAILURE);
             }
-
+            exit(fleet_discover(strcasecmp(optarg, "json") == 0 ? FLEET_JSON : FLEET_TABLE) == 0 ?
+                 EXIT_SUCCESS : EXIT_FAILURE);
+            break;
+        case 'o' :
             if (strcasecmp(optarg, "all") == 0)
             {
                 if(all_check_flag == 1)
@@ -657,13 +1104,6 @@ int main(int argc, char *argv[])
             }
             break;
         case 'f' :
-            if (detect_relay_card_sainsmart_4_8chan(com_port, &num_relays) == -1)
-            {
-                fprintf(stderr,"No compatible device detected.\n");
-                checkPermission();
-                exit(EXIT_FAILURE);
-            }
-
             if (strcasecmp(optarg, "all") == 0)
             {
                 if(all_check_flag == 1)
@@ -689,36 +1129,79 @@ int main(int argc, char *argv[])
             }
             break;
         case 's' :
-            if (detect_relay_card_sainsmart_4_8chan(com_port, &num_relays) == -1)
+            if (strcasecmp(optarg, "all") != 0 && !isdigit(optarg[0]))
             {
-                fprintf(stderr,"No compatible device detected.\n");
-                checkPermission();
+                fprintf(stderr, "invalid value is set to --status argument\n");
                 exit(EXIT_FAILURE);
             }
-            if (strcasecmp(optarg, "all") == 0)
+            op_status = optarg;
+            break;
+        case 'i' :
+            interlock_spec = optarg;
+            break;
+        case 'n' :
+            errno = 0;
+            value = strtoul(optarg, &end, 16);
+            if (errno != 0 || end == optarg || *end != '\0' || value > 0xFF)
             {
-                int relay_states[g_num_relays-1];
-                if (get_relay_sainsmart_4_8chan_all(relay_states) == 0)
-                {
-                    int j;
-                    for(j=0; j<g_num_relays; j++)
-                    {
-                        fprintf(stdout, "%d: %s\n", j+1,(relay_states[j] > 0) ? "ON" : "OFF");
-                    }
-                    exit(EXIT_SUCCESS);
-                }
+                fprintf(stderr, "invalid value is set to --inputs argument\n");
+                exit(EXIT_FAILURE);
             }
-            else if(isdigit(optarg[0]))
+            g_direction_mask = ~(uint8)value;
+            break;
+        case 'c' :
+            capture_cfg.path = optarg;
+            break;
+        case 'r' :
+            errno = 0;
+            value = strtoul(optarg, &end, 10);
+            /* libftdi scales bitbang rates by 4 in an int */
+            if (errno != 0 || end == optarg || *end != '\0' || value == 0 || value > INT_MAX / 4)
             {
-                if (get_relay_sainsmart_4_8chan(atoi(optarg), &rstate) == 0)
-                {
-                    fprintf(stdout, "%d: %s\n", atoi(optarg),(rstate==ON) ? "ON" : "OFF");
-                    exit(EXIT_SUCCESS);
-                }
+                fprintf(stderr, "invalid value is set to --rate argument\n");
+                exit(EXIT_FAILURE);
             }
-            else
+            capture_cfg.rate = value;
+            break;
+        case 'N' :
+            errno = 0;
+            capture_cfg.max_samples = strtoull(optarg, &end, 10);
+            if (errno != 0 || end == optarg || *end != '\0' || *optarg == '-' || capture_cfg.max_samples == 0)
             {
-                fprintf(stderr, "invalid value is set to --status argument\n");
+                fprintf(stderr, "invalid value is set to --samples argument\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't' :
+            trace_path = optarg;
+            break;
+        case 'd' :
+            device_selector = optarg;
+            break;
+        case 'q' :
+            sequence_path = optarg;
+            break;
+        case 'e' :
+            react_spec = optarg;
+            break;
+        case 'u' :
+            react_cpu = atoi(optarg);
+            break;
+        case 'S' :
+            serve = 1;
+            break;
+        case 'w' :
+            g_watchdog_sec = atoi(optarg);
+            break;
+        case 'E' :
+            estop_count = 1;
+            break;
+        case 'T' :
+            estop_count = atoi(optarg);
+            estop_test = 1;
+            if (estop_count <= 0)
+            {
+                fprintf(stderr, "invalid value is set to --estop-test argument\n");
                 exit(EXIT_FAILURE);
             }
             break;
@@ -740,97 +1223,167 @@ int main(int argc, char *argv[])
         }
     }
 
-
-    char **op_relay_list = {0};
-    size_t numtokens = 0;
-    int i = 0;
-    size_t numtok = 0;
-    int *relays;
-
-    /*
-    * Get the current status of the relay
-    */
-    uint8 relay_data;
-    if (get_relay_sainsmart_4_8chan_raw(&relay_data) != 0)
+    if (opOn == -1 && opOff == -1 && op_status == NULL && capture_cfg.path == NULL && sequence_path == NULL &&
+            react_spec == NULL && !serve && estop_count == 0)
     {
-        fprintf(stderr, "Error reading from the relay");
+        exit(EXIT_SUCCESS);
     }
 
     /*
-    * Process all the multiple relay ON state operation
+    * Relay outputs can never be used as inputs
     */
-
-    if(opOn == ID_ON_ALL)
+    if ((~g_direction_mask) & relay_mask_all(g_num_relays))
     {
-        for(i=1; i<= g_num_relays; i++)
-        {
-            relay_data = relay_data | (0x01<<(i-1));
+        fprintf(stderr, "invalid value is set to --inputs argument, relay pins can not be inputs\n");
+        exit(EXIT_FAILURE);
+    }
+    capture_cfg.direction_mask = g_direction_mask;
 
-        }
+    if (trace_path != NULL && trace_open(trace_path) != 0)
+    {
+        exit(EXIT_FAILURE);
     }
-    else if(opOn == ID_ON)
+
+    if (device_selector != NULL)
     {
+        g_device_selector = expand_device_selector(device_selector);
+    }
 
-        relay_data = relay_data | (0x01<<(atoi(op_relay_on)-1));
+    if (detect_relay_card_sainsmart_4_8chan(com_port, &num_relays) == -1)
+    {
+        fprintf(stderr,"No compatible device detected.\n");
+        checkPermission();
+        exit(EXIT_FAILURE);
     }
-    else if(opOn == ID_ON_MULTIPLE)
+
+    /*
+    * Emergency stop
+    */
+    if (estop_count > 0)
     {
+        exit(estop_sainsmart_4_8chan(estop_count, estop_test) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
 
-        op_relay_list = strsplit(op_relay_on, ", \t\n", &numtokens);
-        int relay_list[numtokens];
-        for (i = 0; i < numtokens; i++)
-        {
-            relay_list[i] = atoi(strdup(op_relay_list[i]));
-            free(op_relay_list[i]);
-        }
-        relays = remove_duplicate(relay_list,numtokens,&numtok);
+    /*
+    * Long running modes keep the emergency stop armed
+    */
+    if (capture_cfg.path != NULL || sequence_path != NULL || react_spec != NULL || serve)
+    {
+        arm_estop_sainsmart_4_8chan();
+    }
 
-        for(i=0; i< numtok; i++)
+    /*
+    * Report the relay status
+    */
+    if (op_status != NULL)
+    {
+        if (strcasecmp(op_status, "all") == 0)
         {
-            if(relays[i] != 0)
+            int relay_states[MAX_NUM_RELAYS];
+            if (get_relay_sainsmart_4_8chan_all(relay_states) == 0)
             {
-                relay_data = relay_data | (0x01<<(relays[i]-1));
+                int j;
+                for(j=0; j<g_num_relays; j++)
+                {
+                    fprintf(stdout, "%d: %s\n", j+1,(relay_states[j] > 0) ? "ON" : "OFF");
+                }
+                exit(EXIT_SUCCESS);
             }
-
         }
+        else if (get_relay_sainsmart_4_8chan(atoi(op_status), &rstate) == 0)
+        {
+            fprintf(stdout, "%d: %s\n", atoi(op_status),(rstate==ON) ? "ON" : "OFF");
+            exit(EXIT_SUCCESS);
+        }
+        exit(EXIT_FAILURE);
+    }
 
-
+    /*
+    * Capture the input pins
+    */
+    if (capture_cfg.path != NULL)
+    {
+        exit(capture_sainsmart_4_8chan(&capture_cfg) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
     }
 
+
     /*
-    * Process all the multiple relay OFF state operation
+    * Compile the interlock rules before anything is written
     */
-    if(opOff == ID_OFF_ALL)
+    interlock_init(&g_interlock);
+    if (interlock_spec == NULL)
     {
-        for(i=1; i<= g_num_relays; i++)
-        {
-            relay_data = relay_data & ~(0x01<<(i-1));
+        interlock_spec = getenv(INTERLOCK_ENV);
+    }
+    if (interlock_spec != NULL && interlock_parse(&g_interlock, interlock_spec, g_num_relays) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
 
-        }
+    /*
+    * Run a relay sequence
+    */
+    if (sequence_path != NULL)
+    {
+        exit(sequence_sainsmart_4_8chan(sequence_path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
     }
-    else if(opOff == ID_OFF)
+
+    /*
+    * React to input edges
+    */
+    if (react_spec != NULL)
     {
+        exit(react_sainsmart_4_8chan(react_spec, react_cpu) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
 
-        relay_data = relay_data & ~(0x01<<(atoi(op_relay_off)-1));
+    /*
+    * Serve queued relay commands
+    */
+    if (serve)
+    {
+        exit(serve_sainsmart_4_8chan() == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
     }
-    else if(opOff == ID_OFF_MULTIPLE)
+
+    /*
+    * Get the current status of the relay
+    */
+    uint8 relay_data;
+    if (get_relay_sainsmart_4_8chan_raw(&relay_data) != 0)
     {
-        op_relay_list = strsplit(op_relay_off, ", \t\n", &numtokens);
-        int relay_list[numtokens];
-        for (i = 0; i < numtokens; i++)
+        fprintf(stderr, "Error reading from the relay\n");
+        /*
+         * Switching every relay off does not depend on the read. Any
+         * other change would overwrite the relays it does not name.
+         */
+        if (opOn != -1 || opOff != ID_OFF_ALL)
         {
-            relay_list[i] = atoi(strdup(op_relay_list[i]));
-            free(op_relay_list[i]);
+            exit(EXIT_FAILURE);
         }
-        relays = remove_duplicate(relay_list,numtokens,&numtok);
+        relay_data = 0;
+    }
 
-        for(i=0; i< numtok; i++)
-        {
-            if(relays[i] != 0)
-            {
-                relay_data = relay_data & ~(0x01<<(relays[i]-1));
-            }
-        }
+    /*
+    * Process all the multiple relay ON state operation
+    */
+    if(opOn == ID_ON_ALL)
+    {
+        relay_data |= relay_mask_all(g_num_relays);
+    }
+    else if(opOn == ID_ON || opOn == ID_ON_MULTIPLE)
+    {
+        relay_data |= relay_mask_from_list(op_relay_on, g_num_relays);
+    }
+
+    /*
+    * Process all the multiple relay OFF state operation
+    */
+    if(opOff == ID_OFF_ALL)
+    {
+        relay_data &= ~relay_mask_all(g_num_relays);
+    }
+    else if(opOff == ID_OFF || opOff == ID_OFF_MULTIPLE)
+    {
+        relay_data &= ~relay_mask_from_list(op_relay_off, g_num_relays);
     }
 
     /*
@@ -840,7 +1393,7 @@ int main(int argc, char *argv[])
     {
         if (set_relay_sainsmart_4_8chan_write(relay_data) == 0)
         {
-            int relay_states[g_num_relays-1];
+            int relay_states[MAX_NUM_RELAYS];
             if (get_relay_sainsmart_4_8chan_all(relay_states) == 0)
             {
                 int j;
@@ -3,12 +3,16 @@
 
 #define VENDOR_ID 0x0403
 #define DEVICE_ID 0x6001
+#define DEVICE_ENV "SAINSMART_DEVICE"
 
 #define FIRST_RELAY    1
 #define MAX_NUM_RELAYS 4
 #define MAX_RELAY_CARD_NAME_LEN 40
 #define MAX_COM_PORT_NAME_LEN 32
 
+#define RELAY_ERR_INTERLOCK -5
+#define RELAY_ERR_ESTOP     -6
+
 typedef unsigned char  uint8;
 typedef unsigned short uint16;
 typedef unsigned long  uint32;
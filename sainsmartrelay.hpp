@@ -0,0 +1,259 @@
+#ifndef sainsmartrelay_hpp
+#define sainsmartrelay_hpp
+
+/*
+ * Header-only C++ interface to the Sainsmart 4/8 channel USB relay card.
+ *
+ * Channels and masks are compile-time values: RelayBank<4>::on<1, 3>()
+ * is checked against the number of relays on the card when it is
+ * compiled and turns into a single write of a precomputed mask. The
+ * bank keeps a shadow copy of the output byte, so switching relays
+ * never needs a read back from the card.
+ *
+ * Requires C++14 and libftdi (link with -lftdi -lusb); nothing else
+ * from this package has to be linked.
+ */
+
+#include <ftdi.h>
+#include <stdint.h>
+
+namespace sainsmart
+{
+
+/* The values of sainsmartrelay.h, kept out of the global namespace */
+constexpr int vendor_id = 0x0403;
+constexpr int device_id = 0x6001;
+constexpr unsigned first_relay = 1;
+constexpr int err_interlock = -5;
+
+template <unsigned N>
+class Mask
+{
+public:
+    static_assert(N >= 1 && N <= 8, "the FT245R has 8 data pins");
+
+    constexpr Mask() : bits_(0) {}
+    constexpr explicit Mask(uint8_t bits) : bits_(bits & all_bits) {}
+
+    static constexpr Mask none() { return Mask(); }
+    static constexpr Mask all() { return Mask(all_bits); }
+
+    constexpr uint8_t value() const { return bits_; }
+    constexpr bool test(unsigned channel) const { return (bits_ >> (channel - first_relay)) & 0x01; }
+
+    constexpr Mask operator|(Mask other) const { return Mask(bits_ | other.bits_); }
+    constexpr Mask operator&(Mask other) const { return Mask(bits_ & other.bits_); }
+    constexpr Mask operator~() const { return Mask(~bits_); }
+    constexpr bool operator==(Mask other) const { return bits_ == other.bits_; }
+    constexpr bool operator!=(Mask other) const { return bits_ != other.bits_; }
+
+private:
+    static constexpr uint8_t all_bits = (uint8_t)((1u << N) - 1);
+    uint8_t bits_;
+};
+
+/* A relay channel, numbered from first_relay like on the command line */
+template <unsigned N, unsigned C>
+struct Channel
+{
+    static_assert(C >= first_relay && C < first_relay + N, "relay channel out of range for this card");
+    static constexpr unsigned number = C;
+    static constexpr Mask<N> mask() { return Mask<N>((uint8_t)(0x01 << (C - first_relay))); }
+};
+
+template <unsigned N>
+constexpr Mask<N> channels()
+{
+    return Mask<N>();
+}
+
+template <unsigned N, unsigned C, unsigned... Rest>
+constexpr Mask<N> channels()
+{
+    return Channel<N, C>::mask() | channels<N, Rest...>();
+}
+
+/*
+ * Relays that must never be on together, like --interlock on the command
+ * line. Every rule is folded into a table over all output masks when it
+ * is added, so checking a write is a single lookup.
+ */
+template <unsigned N>
+class Interlock
+{
+public:
+    typedef sainsmart::Mask<N> Mask;
+
+    static constexpr unsigned max_rules = 32;
+
+    Interlock() : num_rules_(0), table_() {}
+
+    /* Forbid the relays in rule from being on together.
+     * Return: 0 - success, -1 - fewer than two relays or too many rules */
+    int forbid(Mask rule)
+    {
+        unsigned data;
+
+        if (num_rules_ == max_rules || (rule.value() & (rule.value() - 1)) == 0)
+        {
+            return -1;
+        }
+        num_rules_++;
+        for (data = 0; data < 256; data++)
+        {
+            /* earlier rules take precedence when reporting a violation */
+            if (table_[data] == 0 && (data & rule.value()) == rule.value())
+            {
+                table_[data] = num_rules_;
+            }
+        }
+        return 0;
+    }
+
+    template <unsigned... C>
+    int forbid()
+    {
+        static_assert(sizeof...(C) >= 2, "an interlock rule needs at least two relays");
+        return forbid(channels<N, C...>());
+    }
+
+    /* 0 if data is allowed, otherwise the number of the first violated rule */
+    int check(uint8_t data) const { return table_[data]; }
+
+    unsigned num_rules() const { return num_rules_; }
+
+private:
+    uint8_t num_rules_;
+    uint8_t table_[256];
+};
+
+template <unsigned N>
+class RelayBank
+{
+public:
+    static_assert(N == 4 || N == 8, "Sainsmart cards have 4 or 8 relays");
+
+    typedef sainsmart::Mask<N> Mask;
+    template <unsigned C> using Channel = sainsmart::Channel<N, C>;
+
+    /* Mask of the listed channels, checked and folded at compile time */
+    template <unsigned... C>
+    static constexpr Mask mask() { return channels<N, C...>(); }
+
+    RelayBank() : ftdi_(nullptr), shadow_(0), interlock_(nullptr) {}
+    ~RelayBank() { close(); }
+
+    RelayBank(const RelayBank &) = delete;
+    RelayBank &operator=(const RelayBank &) = delete;
+
+    /**********************************************************
+     * Open the card, switch it to bitbang mode and read the
+     * current output state once.
+     *
+     * selector (in) - libftdi description string as accepted by
+     *                 ftdi_usb_open_string(), or nullptr for the
+     *                 first Sainsmart card.
+     *
+     * Return:    0 - success, < 0 - fail
+     *********************************************************/
+    int open(const char *selector = nullptr, uint8_t direction_mask = 0xFF)
+    {
+        if (ftdi_ != nullptr)
+        {
+            return 0;
+        }
+        if ((ftdi_ = ftdi_new()) == nullptr)
+        {
+            return -1;
+        }
+        int ret = selector ? ftdi_usb_open_string(ftdi_, selector)
+                           : ftdi_usb_open(ftdi_, vendor_id, device_id);
+        if (ret < 0)
+        {
+            ftdi_free(ftdi_);
+            ftdi_ = nullptr;
+            return -2;
+        }
+        if (ftdi_set_bitmode(ftdi_, direction_mask, BITMODE_BITBANG) < 0 ||
+                ftdi_read_pins(ftdi_, &shadow_) < 0)
+        {
+            close();
+            return -3;
+        }
+        return 0;
+    }
+
+    void close()
+    {
+        if (ftdi_ != nullptr)
+        {
+            ftdi_usb_close(ftdi_);
+            ftdi_free(ftdi_);
+            ftdi_ = nullptr;
+        }
+    }
+
+    bool is_open() const { return ftdi_ != nullptr; }
+
+    /* Check every write against an interlock rule set (may be nullptr) */
+    void set_interlock(const Interlock<N> *interlock) { interlock_ = interlock; }
+
+    /* Outputs as last written, without touching the card */
+    Mask state() const { return Mask(shadow_); }
+
+    /* Read the outputs back from the card */
+    int read(Mask &state)
+    {
+        if (ftdi_read_pins(ftdi_, &shadow_) < 0)
+        {
+            return -3;
+        }
+        state = Mask(shadow_);
+        return 0;
+    }
+
+    /* Switch the relays in on_mask on and those in off_mask off with one write */
+    int apply(Mask on_mask, Mask off_mask)
+    {
+        return write_raw((uint8_t)((shadow_ | on_mask.value()) & ~off_mask.value()));
+    }
+
+    /* Replace the state of every relay */
+    int write(Mask relays)
+    {
+        return write_raw((uint8_t)((shadow_ & ~Mask::all().value()) | relays.value()));
+    }
+
+    template <unsigned... C> int on() { return apply(mask<C...>(), Mask::none()); }
+    template <unsigned... C> int off() { return apply(Mask::none(), mask<C...>()); }
+    int all_on() { return apply(Mask::all(), Mask::none()); }
+    int all_off() { return apply(Mask::none(), Mask::all()); }
+
+private:
+    int write_raw(uint8_t data)
+    {
+        if (interlock_ != nullptr && interlock_->check(data) != 0)
+        {
+            return err_interlock;
+        }
+        if (ftdi_write_data(ftdi_, &data, 1) < 0)
+        {
+            return -4;
+        }
+        shadow_ = data;
+        return 0;
+    }
+
+    struct ftdi_context *ftdi_;
+    uint8_t shadow_;
+    const Interlock<N> *interlock_;
+};
+
+/* The masks below must fold to constants; if they do not, this header does not compile */
+static_assert(RelayBank<4>::mask<1, 3>().value() == 0x05, "channel mask folding");
+static_assert(RelayBank<8>::mask<8>().value() == 0x80, "channel mask folding");
+static_assert(RelayBank<4>::Mask::all().value() == 0x0F, "all relays mask");
+
+}
+
+#endif
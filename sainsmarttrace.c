@@ -0,0 +1,402 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <ftdi.h>
+#include <getopt.h>
+
+#include "sainsmartrelay.h"
+#include "interlock.h"
+#include "relaylist.h"
+#include "trace.h"
+
+static char *g_device_selector = NULL;
+
+static void usage(char *myName)
+{
+    fprintf(stderr, "\nUsage:\n");
+    fprintf(stderr, "  %s --summary FILE\n", myName);
+    fprintf(stderr, "  %s --replay FILE [--speed FACTOR] [--simulate] [--device s:SERIAL|d:BUS/DEV]\n", myName);
+    fprintf(stderr, "  %s -h\n", myName);
+}
+
+static void help(char *myName)
+{
+    fprintf(stdout, "\nHelp:\n %s --summary FILE | --replay FILE [--speed FACTOR] [--simulate] | [-h]\n", myName);
+    fprintf(stdout, "  --help|-h  print this help.\n");
+    fprintf(stdout, "  --summary | -s FILE  print the latency distribution of every operation in the trace.\n");
+    fprintf(stdout, "  --replay | -r FILE  replay the trace against the relay card.\n");
+    fprintf(stdout, "  --speed | -x FACTOR  replay FACTOR times faster than recorded (default 1).\n");
+    fprintf(stdout, "  --simulate | -m  replay against a simulated card that takes the recorded time per operation.\n");
+    fprintf(stdout, "  --device | -d [s:SERIAL|d:BUS/DEV]  replay against the card with the given serial number or\n");
+    fprintf(stdout, "                          bus/device numbers instead of the first one found. Defaults to $%s.\n", DEVICE_ENV);
+    fprintf(stdout, "  Capture reads (read_data, set_baudrate, purge) are summarised but not replayed.\n");
+    fprintf(stdout, "  Replayed writes are checked against the interlock rules in $%s.\n", INTERLOCK_ENV);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**********************************************************
+ * Function load_trace()
+ *
+ * Description: Read a trace file into memory. A partial
+ *              record at the end of the file (e.g. the program
+ *              was killed while writing it) is reported and
+ *              ignored.
+ *
+ * Parameters: path (in)        - trace file
+ *             num_records(out) - number of records read
+ *
+ * Return:  array of records, NULL on failure
+ *********************************************************/
+static trace_record_t *load_trace(const char *path, size_t *num_records)
+{
+    unsigned char header[8];
+    trace_record_t *records = NULL;
+    size_t alloc = 0, used = 0, n = 0;
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+    {
+        fprintf(stderr, "unable to open trace file %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+            memcmp(header, TRACE_MAGIC, 4) != 0 || header[4] != TRACE_VERSION)
+    {
+        fprintf(stderr, "%s is not a trace file\n", path);
+        fclose(fp);
+        return NULL;
+    }
+
+    for (;;)
+    {
+        if (used == alloc)
+        {
+            trace_record_t *grown;
+
+            alloc = alloc ? alloc * 2 : 1024;
+            if ((grown = realloc(records, alloc * sizeof(trace_record_t))) == NULL)
+            {
+                fprintf(stderr, "out of memory reading trace file %s\n", path);
+                free(records);
+                fclose(fp);
+                return NULL;
+            }
+            records = grown;
+        }
+        if ((n = fread(&records[used], 1, sizeof(trace_record_t), fp)) != sizeof(trace_record_t))
+        {
+            break;
+        }
+        used++;
+    }
+    if (ferror(fp))
+    {
+        fprintf(stderr, "error reading trace file %s: %s\n", path, strerror(errno));
+        free(records);
+        fclose(fp);
+        return NULL;
+    }
+    if (n != 0)
+    {
+        fprintf(stderr, "warning: %s ends with a truncated record (%zu of %zu bytes), ignored\n",
+                path, n, sizeof(trace_record_t));
+    }
+    fclose(fp);
+
+    *num_records = used;
+    return records;
+}
+
+/**********************************************************
+ * Function print_summary()
+ *
+ * Description: Print count, errors and latency percentiles
+ *              of every operation type
+ *
+ * Parameters: records (in)     - trace records
+ *             num_records (in) - number of records
+ *********************************************************/
+static void print_summary(const trace_record_t *records, size_t num_records)
+{
+    uint32_t *durations = malloc((num_records ? num_records : 1) * sizeof(uint32_t));
+    size_t i;
+    int op;
+
+    fprintf(stdout, "%-12s %8s %6s %10s %10s %10s %10s %10s\n",
+            "op", "count", "errors", "min(us)", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+
+    for (op = 0; op < TRACE_OP_COUNT; op++)
+    {
+        size_t n = 0, errors = 0;
+
+        if (op == TRACE_OP_DROPPED)
+        {
+            continue;
+        }
+
+        for (i = 0; i < num_records; i++)
+        {
+            if (records[i].op == op)
+            {
+                durations[n++] = records[i].duration_ns;
+                if (records[i].result < 0)
+                {
+                    errors++;
+                }
+            }
+        }
+        if (n == 0)
+        {
+            continue;
+        }
+        qsort(durations, n, sizeof(uint32_t), compare_u32);
+        fprintf(stdout, "%-12s %8zu %6zu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                trace_op_name(op), n, errors,
+                durations[0] / 1000.0, durations[n / 2] / 1000.0,
+                durations[(n * 90) / 100] / 1000.0, durations[(n * 99) / 100] / 1000.0,
+                durations[n - 1] / 1000.0);
+    }
+
+    for (i = 0; i < num_records; i++)
+    {
+        if (records[i].op == TRACE_OP_DROPPED)
+        {
+            fprintf(stdout, "dropped records: %u\n", records[i].duration_ns);
+        }
+    }
+    if (num_records > 1)
+    {
+        fprintf(stdout, "trace span: %.3f s\n",
+                (records[num_records-1].start_ns - records[0].start_ns) / 1e9);
+    }
+    free(durations);
+}
+
+/**********************************************************
+ * Function replayable()
+ *
+ * Description: Whether an operation is replayed. Capture reads
+ *              depend on the bitbang clock of the recording and
+ *              are only summarised.
+ *********************************************************/
+static int replayable(int op)
+{
+    return op == TRACE_OP_OPEN || op == TRACE_OP_SET_BITMODE || op == TRACE_OP_READ_PINS ||
+           op == TRACE_OP_WRITE || op == TRACE_OP_CLOSE || op == TRACE_OP_READ_CHIPID;
+}
+
+/**********************************************************
+ * Function replay_op()
+ *
+ * Description: Perform one recorded operation against the
+ *              card or the simulated card
+ *
+ * Return:  libftdi style return code
+ *********************************************************/
+static int replay_op(struct ftdi_context *ftdi, const trace_record_t *rec,
+                     const interlock_t *il, int simulate)
+{
+    unsigned char buf[1];
+    unsigned int chipid;
+
+    if (simulate)
+    {
+        struct timespec ts = { rec->duration_ns / 1000000000u, rec->duration_ns % 1000000000u };
+        nanosleep(&ts, NULL);
+        return rec->result;
+    }
+
+    switch (rec->op)
+    {
+    case TRACE_OP_OPEN:
+        return g_device_selector ? ftdi_usb_open_string(ftdi, g_device_selector)
+                                 : ftdi_usb_open(ftdi, VENDOR_ID, DEVICE_ID);
+    case TRACE_OP_READ_CHIPID:
+        return ftdi_read_chipid(ftdi, &chipid);
+    case TRACE_OP_SET_BITMODE:
+        return ftdi_set_bitmode(ftdi, rec->data, BITMODE_BITBANG);
+    case TRACE_OP_READ_PINS:
+        return ftdi_read_pins(ftdi, buf);
+    case TRACE_OP_WRITE:
+        if (interlock_check(il, rec->data) != 0)
+        {
+            fprintf(stderr, "skipping write of 0x%02X, rejected by interlock\n", rec->data);
+            return RELAY_ERR_INTERLOCK;
+        }
+        buf[0] = rec->data;
+        return ftdi_write_data(ftdi, buf, 1);
+    case TRACE_OP_CLOSE:
+        return ftdi_usb_close(ftdi);
+    }
+    return 0;
+}
+
+/**********************************************************
+ * Function replay_trace()
+ *
+ * Description: Replay a trace at its original pace divided by
+ *              speed and summarise the replayed latencies
+ *
+ * Return:    0 - success
+ *          < 0 - fail
+ *********************************************************/
+static int replay_trace(trace_record_t *records, size_t num_records, double speed, int simulate)
+{
+    struct ftdi_context *ftdi = NULL;
+    interlock_t il;
+    const char *spec;
+    uint64_t base_ns, first_ns;
+    size_t i, replayed = 0, errors = 0;
+
+    interlock_init(&il);
+    if ((spec = getenv(INTERLOCK_ENV)) != NULL && interlock_parse(&il, spec, MAX_NUM_RELAYS) != 0)
+    {
+        return -1;
+    }
+    if (num_records == 0)
+    {
+        return 0;
+    }
+    if (!simulate && (ftdi = ftdi_new()) == 0)
+    {
+        fprintf(stderr, "ftdi_new failed\n");
+        return -1;
+    }
+
+    first_ns = records[0].start_ns;
+    base_ns = trace_now_ns();
+    for (i = 0; i < num_records; i++)
+    {
+        uint64_t due_ns = base_ns + (uint64_t)((records[i].start_ns - first_ns) / speed);
+        struct timespec due = { due_ns / 1000000000ull, due_ns % 1000000000ull };
+        uint64_t t0;
+        int ret;
+
+        if (!replayable(records[i].op))
+        {
+            continue;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+        {
+        }
+
+        replayed++;
+        t0 = trace_now_ns();
+        ret = replay_op(ftdi, &records[i], &il, simulate);
+        records[i].duration_ns = trace_now_ns() - t0;
+        records[i].result = ret < INT16_MIN ? INT16_MIN : ret;
+        if (ret < 0)
+        {
+            errors++;
+        }
+        /* keep only replayed records for the summary */
+        records[replayed-1] = records[i];
+    }
+
+    fprintf(stdout, "replayed %zu operations, %zu failed\n", replayed, errors);
+    print_summary(records, replayed);
+    if (ftdi != NULL)
+    {
+        ftdi_free(ftdi);
+    }
+    return errors ? -2 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int long_index = 0;
+    char *summary_path = NULL;
+    char *replay_path = NULL;
+    double speed = 1.0;
+    int simulate = 0;
+    char *device_selector = getenv(DEVICE_ENV);
+    trace_record_t *records;
+    size_t num_records = 0;
+    int ret;
+
+    static struct option long_options[] =
+    {
+        {"help",     no_argument,       0,  'h' },
+        {"summary",  required_argument, 0,  's' },
+        {"replay",   required_argument, 0,  'r' },
+        {"speed",    required_argument, 0,  'x' },
+        {"simulate", no_argument,       0,  'm' },
+        {"device",   required_argument, 0,  'd' },
+        {0,          0,                 0,  0   }
+    };
+
+    while ((opt = getopt_long(argc, argv, ":hs:r:x:md:", long_options, &long_index)) != -1)
+    {
+        switch (opt)
+        {
+        case 's' :
+            summary_path = optarg;
+            break;
+        case 'r' :
+            replay_path = optarg;
+            break;
+        case 'x' :
+            speed = atof(optarg);
+            if (speed <= 0)
+            {
+                fprintf(stderr, "invalid value is set to --speed argument\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm' :
+            simulate = 1;
+            break;
+        case 'd' :
+            device_selector = optarg;
+            break;
+        case 'h' :
+            help(argv[0]);
+            exit(EXIT_SUCCESS);
+        case ':':
+            fprintf(stderr, "%s: option `-%c' requires an argument\n", argv[0], optopt);
+            exit(EXIT_FAILURE);
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if ((summary_path == NULL) == (replay_path == NULL))
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (device_selector != NULL)
+    {
+        g_device_selector = expand_device_selector(device_selector);
+    }
+
+    if ((records = load_trace(summary_path ? summary_path : replay_path, &num_records)) == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    if (summary_path != NULL)
+    {
+        print_summary(records, num_records);
+        ret = 0;
+    }
+    else
+    {
+        ret = replay_trace(records, num_records, speed, simulate);
+    }
+
+    free(records);
+    free(g_device_selector);
+    exit(ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
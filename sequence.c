@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "sequence.h"
+#include "relaylist.h"
+
+typedef struct
+{
+    char name[SEQ_MAX_LABEL_LEN];
+    uint32_t target;
+}
+seq_label_t;
+
+/**********************************************************
+ * Function seq_emit()
+ *
+ * Description: Append an instruction to the program
+ *
+ * Return:  pointer to the new instruction, NULL if out of memory
+ *********************************************************/
+static seq_insn_t *seq_emit(seq_program_t *prog, uint8 op, uint32_t line)
+{
+    seq_insn_t *insn;
+
+    if (prog->num_insn == prog->alloc_insn)
+    {
+        size_t alloc = prog->alloc_insn ? prog->alloc_insn * 2 : 16;
+        seq_insn_t *grown = realloc(prog->insn, alloc * sizeof(seq_insn_t));
+        if (grown == NULL)
+        {
+            return NULL;
+        }
+        prog->insn = grown;
+        prog->alloc_insn = alloc;
+    }
+    insn = &prog->insn[prog->num_insn++];
+    memset(insn, 0, sizeof(*insn));
+    insn->op = op;
+    insn->line = line;
+    return insn;
+}
+
+/**********************************************************
+ * Function seq_parse_duration()
+ *
+ * Description: Parse a duration with an optional unit
+ *              (ns, us, ms, s, min). Plain numbers are ms.
+ *              nan, inf and anything beyond INT64_MAX ns (about
+ *              292 years) are rejected.
+ *
+ * Return:  0 - success, -1 - invalid duration
+ *********************************************************/
+static int seq_parse_duration(const char *arg, uint64_t *ns)
+{
+    char *unit;
+    double value;
+    double scale;
+
+    errno = 0;
+    value = strtod(arg, &unit);
+    if (unit == arg || errno != 0 || !isfinite(value) || value < 0)
+    {
+        return -1;
+    }
+    if (*unit == '\0' || strcmp(unit, "ms") == 0)
+        scale = 1e6;
+    else if (strcmp(unit, "ns") == 0)
+        scale = 1;
+    else if (strcmp(unit, "us") == 0)
+        scale = 1e3;
+    else if (strcmp(unit, "s") == 0)
+        scale = 1e9;
+    else if (strcmp(unit, "min") == 0)
+        scale = 60e9;
+    else
+        return -1;
+
+    /* INT64_MAX is not exactly representable; compare against 2^63 */
+    if (value * scale + 0.5 >= 9223372036854775808.0)
+    {
+        return -1;
+    }
+    *ns = (uint64_t)(value * scale + 0.5);
+    return 0;
+}
+
+/**********************************************************
+ * Function seq_compile()
+ *
+ * Description: Compile a relay sequence into bytecode. One
+ *              statement per line, '#' starts a comment:
+ *
+ *                set 1,3         switch relays on
+ *                clear 2         switch relays off
+ *                mask 0x05       set every relay to the given mask
+ *                wait 250ms      wait (ns, us, ms, s, min; default ms)
+ *                label NAME      mark a loop start
+ *                repeat NAME N   run from label NAME N times in total
+ *                                (0 = forever)
+ *
+ *              Writes that follow each other without a wait or a
+ *              label in between are merged into a single write.
+ *
+ * Parameters: prog (out)      - compiled program
+ *             fp (in)         - sequence source
+ *             num_relays (in) - number of relays on the card
+ *
+ * Return:    0 - success
+ *           -1 - fail, syntax error (reported on stderr)
+ *********************************************************/
+int seq_compile(seq_program_t *prog, FILE *fp, uint8 num_relays)
+{
+    seq_label_t *labels = NULL;
+    size_t num_labels = 0;
+    char line_buf[256];
+    uint32_t line = 0;
+    size_t label_pos = (size_t)-1;      /* instruction index a label points at */
+    uint8 all = (uint8)((1u << num_relays) - 1);
+
+    memset(prog, 0, sizeof(*prog));
+
+    while (fgets(line_buf, sizeof(line_buf), fp) != NULL)
+    {
+        char *cmd, *arg, *arg2, *ctx;
+        seq_insn_t *insn = NULL;
+        uint8 mask;
+
+        line++;
+        if ((cmd = strchr(line_buf, '#')) != NULL)
+        {
+            *cmd = '\0';
+        }
+        if ((cmd = strtok_r(line_buf, " \t\r\n", &ctx)) == NULL)
+        {
+            continue;
+        }
+        arg = strtok_r(NULL, " \t\r\n", &ctx);
+        arg2 = strtok_r(NULL, " \t\r\n", &ctx);
+
+        if (arg == NULL)
+        {
+            fprintf(stderr, "line %u: '%s' needs an argument\n", line, cmd);
+            goto fail;
+        }
+
+        if (strcasecmp(cmd, "set") == 0 || strcasecmp(cmd, "clear") == 0 || strcasecmp(cmd, "mask") == 0)
+        {
+            uint8 on, off;
+
+            if (strcasecmp(cmd, "mask") == 0)
+            {
+                char *end;
+                unsigned long value = strtoul(arg, &end, 0);
+                if (*end != '\0' || value > all)
+                {
+                    fprintf(stderr, "line %u: invalid mask '%s'\n", line, arg);
+                    goto fail;
+                }
+                on = value;
+                off = all & ~on;
+            }
+            else
+            {
+                if (relay_list_parse(arg, num_relays, &mask) != 0)
+                {
+                    fprintf(stderr, "line %u: invalid relay list '%s'\n", line, arg);
+                    goto fail;
+                }
+                on = (tolower(cmd[0]) == 's') ? mask : 0;
+                off = (tolower(cmd[0]) == 's') ? 0 : mask;
+            }
+
+            /* Merge with a directly preceding write */
+            if (prog->num_insn > 0 && label_pos != prog->num_insn &&
+                    prog->insn[prog->num_insn-1].op == SEQ_OP_WRITE)
+            {
+                insn = &prog->insn[prog->num_insn-1];
+                insn->on_mask = on | (insn->on_mask & ~off);
+                insn->off_mask = off | (insn->off_mask & ~on);
+                continue;
+            }
+            if ((insn = seq_emit(prog, SEQ_OP_WRITE, line)) == NULL)
+            {
+                goto nomem;
+            }
+            insn->on_mask = on;
+            insn->off_mask = off;
+        }
+        else if (strcasecmp(cmd, "wait") == 0)
+        {
+            if ((insn = seq_emit(prog, SEQ_OP_WAIT, line)) == NULL)
+            {
+                goto nomem;
+            }
+            if (seq_parse_duration(arg, &insn->wait_ns) != 0)
+            {
+                fprintf(stderr, "line %u: invalid duration '%s'\n", line, arg);
+                goto fail;
+            }
+        }
+        else if (strcasecmp(cmd, "label") == 0)
+        {
+            seq_label_t *grown;
+            size_t i;
+
+            if (strlen(arg) >= SEQ_MAX_LABEL_LEN)
+            {
+                fprintf(stderr, "line %u: label '%s' is longer than %d characters\n", line, arg, SEQ_MAX_LABEL_LEN - 1);
+                goto fail;
+            }
+            for (i = 0; i < num_labels; i++)
+            {
+                if (strcmp(labels[i].name, arg) == 0)
+                {
+                    fprintf(stderr, "line %u: duplicate label '%s'\n", line, arg);
+                    goto fail;
+                }
+            }
+            if ((grown = realloc(labels, (num_labels + 1) * sizeof(seq_label_t))) == NULL)
+            {
+                goto nomem;
+            }
+            labels = grown;
+            snprintf(labels[num_labels].name, SEQ_MAX_LABEL_LEN, "%s", arg);
+            labels[num_labels++].target = prog->num_insn;
+            label_pos = prog->num_insn;
+        }
+        else if (strcasecmp(cmd, "repeat") == 0)
+        {
+            size_t i;
+            char *end;
+
+            for (i = 0; i < num_labels && strcmp(labels[i].name, arg) != 0; i++)
+            {
+            }
+            if (i == num_labels)
+            {
+                fprintf(stderr, "line %u: unknown label '%s'\n", line, arg);
+                goto fail;
+            }
+            if ((insn = seq_emit(prog, SEQ_OP_REPEAT, line)) == NULL)
+            {
+                goto nomem;
+            }
+            insn->target = labels[i].target;
+            if (arg2 != NULL)
+            {
+                unsigned long count;
+
+                errno = 0;
+                count = strtoul(arg2, &end, 10);
+                /* strtoul() would wrap "-1" to ULONG_MAX */
+                if (!isdigit((unsigned char)arg2[0]) || errno != 0 || *end != '\0' || count > UINT32_MAX)
+                {
+                    fprintf(stderr, "line %u: invalid repeat count '%s'\n", line, arg2);
+                    goto fail;
+                }
+                insn->count = count;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "line %u: unknown statement '%s'\n", line, cmd);
+            goto fail;
+        }
+    }
+
+    if (seq_emit(prog, SEQ_OP_END, line) == NULL)
+    {
+        goto nomem;
+    }
+    prog->stats = calloc(prog->num_insn, sizeof(seq_step_stats_t));
+    prog->counter = calloc(prog->num_insn, sizeof(uint32_t));
+    if (prog->stats == NULL || prog->counter == NULL)
+    {
+        goto nomem;
+    }
+    free(labels);
+    return 0;
+
+nomem:
+    fprintf(stderr, "ERROR: out of memory\n");
+fail:
+    free(labels);
+    seq_free(prog);
+    return -1;
+}
+
+/**********************************************************
+ * Function seq_run()
+ *
+ * Description: Execute a compiled sequence. Waits sleep until
+ *              absolute CLOCK_MONOTONIC deadlines measured from
+ *              the start of the run, so time spent writing or
+ *              waking up late is not added to the next step and
+ *              timing error does not accumulate over long loops.
+ *              How late every wait woke up is recorded per step.
+ *
+ * Parameters: prog (in/out) - compiled program
+ *             state (in)    - current output mask of the card
+ *             write (in)    - writes a new output mask
+ *             ctx (in)      - passed to write
+ *             stop (in)     - set asynchronously to end the run
+ *
+ * Return:    0 - success
+ *          < 0 - fail, write error
+ *********************************************************/
+int seq_run(seq_program_t *prog, uint8 state, seq_write_fn write, void *ctx,
+            volatile sig_atomic_t *stop)
+{
+    struct timespec deadline, now;
+    size_t pc = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    while (!*stop)
+    {
+        seq_insn_t *insn = &prog->insn[pc];
+        seq_step_stats_t *stats = &prog->stats[pc];
+        int64_t late_ns;
+        uint8 next;
+
+        switch (insn->op)
+        {
+        case SEQ_OP_WRITE:
+            next = (state | insn->on_mask) & ~insn->off_mask;
+            if (write(next, ctx) != 0)
+            {
+                return -1;
+            }
+            state = next;
+            stats->runs++;
+            pc++;
+            break;
+
+        case SEQ_OP_WAIT:
+            deadline.tv_sec += insn->wait_ns / 1000000000ull;
+            deadline.tv_nsec += insn->wait_ns % 1000000000ull;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+            {
+                if (*stop)
+                {
+                    return 0;
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            late_ns = (int64_t)(now.tv_sec - deadline.tv_sec) * 1000000000ll + (now.tv_nsec - deadline.tv_nsec);
+            if (late_ns < 0)
+            {
+                late_ns = 0;
+            }
+            stats->runs++;
+            stats->late_sum_ns += late_ns;
+            if ((uint64_t)late_ns > stats->late_max_ns)
+            {
+                stats->late_max_ns = late_ns;
+            }
+            pc++;
+            break;
+
+        case SEQ_OP_REPEAT:
+            stats->runs++;
+            if (insn->count == 0 || ++prog->counter[pc] < insn->count)
+            {
+                pc = insn->target;
+            }
+            else
+            {
+                prog->counter[pc] = 0;
+                pc++;
+            }
+            break;
+
+        default:
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/**********************************************************
+ * Function seq_report()
+ *
+ * Description: Print how often each wait ran and how late it
+ *              woke up on average and at worst
+ *********************************************************/
+void seq_report(const seq_program_t *prog, FILE *out)
+{
+    uint64_t worst_ns = 0;
+    size_t i;
+
+    fprintf(out, "%6s %10s %14s %14s\n", "line", "waits", "avg late(us)", "max late(us)");
+    for (i = 0; i < prog->num_insn; i++)
+    {
+        const seq_step_stats_t *stats = &prog->stats[i];
+
+        if (prog->insn[i].op != SEQ_OP_WAIT || stats->runs == 0)
+        {
+            continue;
+        }
+        fprintf(out, "%6u %10llu %14.1f %14.1f\n", prog->insn[i].line,
+                (unsigned long long)stats->runs,
+                stats->late_sum_ns / 1000.0 / stats->runs, stats->late_max_ns / 1000.0);
+        if (stats->late_max_ns > worst_ns)
+        {
+            worst_ns = stats->late_max_ns;
+        }
+    }
+    fprintf(out, "worst lateness: %.1f us\n", worst_ns / 1000.0);
+}
+
+/**********************************************************
+ * Function seq_free()
+ *
+ * Description: Release a compiled program
+ *********************************************************/
+void seq_free(seq_program_t *prog)
+{
+    free(prog->insn);
+    free(prog->stats);
+    free(prog->counter);
+    memset(prog, 0, sizeof(*prog));
+}
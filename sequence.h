@@ -0,0 +1,61 @@
+#ifndef sequence_h
+#define sequence_h
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sainsmartrelay.h"
+
+#define SEQ_MAX_LABEL_LEN 32
+
+typedef enum
+{
+    SEQ_OP_WRITE = 0,   /* state = (state | on_mask) & ~off_mask */
+    SEQ_OP_WAIT,        /* sleep until the previous deadline + wait_ns */
+    SEQ_OP_REPEAT,      /* jump to target until the block ran count times (0 = forever) */
+    SEQ_OP_END
+}
+seq_op_t;
+
+typedef struct
+{
+    uint8 op;
+    uint8 on_mask;
+    uint8 off_mask;
+    uint8 reserved;
+    uint32_t target;
+    uint32_t count;
+    uint32_t line;      /* source line, for reporting */
+    uint64_t wait_ns;
+}
+seq_insn_t;
+
+typedef struct
+{
+    uint64_t runs;
+    uint64_t late_sum_ns;
+    uint64_t late_max_ns;
+}
+seq_step_stats_t;
+
+typedef struct
+{
+    seq_insn_t *insn;
+    seq_step_stats_t *stats;    /* one entry per instruction */
+    uint32_t *counter;          /* repeat counters, one entry per instruction */
+    size_t num_insn;
+    size_t alloc_insn;
+}
+seq_program_t;
+
+/* Write a new output mask; returns 0 on success */
+typedef int (*seq_write_fn)(uint8 data, void *ctx);
+
+int seq_compile(seq_program_t *prog, FILE *fp, uint8 num_relays);
+int seq_run(seq_program_t *prog, uint8 state, seq_write_fn write, void *ctx,
+            volatile sig_atomic_t *stop);
+void seq_report(const seq_program_t *prog, FILE *out);
+void seq_free(seq_program_t *prog);
+
+#endif
@@ -0,0 +1,56 @@
+#include <stddef.h>
+
+#include "alloccount.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+alloc_count_t g_alloc_count;
+
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+    g_alloc_count.calls++;
+    if (p != NULL)
+    {
+        g_alloc_count.live++;
+    }
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+    g_alloc_count.calls++;
+    if (p != NULL)
+    {
+        g_alloc_count.live++;
+    }
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p = __libc_realloc(ptr, size);
+    g_alloc_count.calls++;
+    if (ptr == NULL && p != NULL)
+    {
+        g_alloc_count.live++;
+    }
+    else if (ptr != NULL && size == 0)
+    {
+        g_alloc_count.live--;
+    }
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr != NULL)
+    {
+        g_alloc_count.live--;
+    }
+    __libc_free(ptr);
+}
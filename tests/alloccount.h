@@ -0,0 +1,18 @@
+#ifndef alloccount_h
+#define alloccount_h
+
+/*
+ * Allocation counters for the bench and test targets. alloccount.c
+ * interposes malloc(), calloc(), realloc() and free(), so every heap
+ * call made by the code under test (strdup() included) is counted.
+ */
+typedef struct
+{
+    unsigned long calls;    /* malloc, calloc and realloc calls */
+    long live;              /* blocks allocated and not yet freed */
+}
+alloc_count_t;
+
+extern alloc_count_t g_alloc_count;
+
+#endif
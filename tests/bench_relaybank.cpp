@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sainsmartrelay.hpp"
+
+extern "C" {
+#include "sainsmartrelay.h"
+}
+
+/* The C++ header repeats these values instead of including the C header */
+static_assert(sainsmart::vendor_id == VENDOR_ID && sainsmart::device_id == DEVICE_ID,
+              "USB ids out of sync with sainsmartrelay.h");
+static_assert(sainsmart::first_relay == FIRST_RELAY, "first relay out of sync with sainsmartrelay.h");
+static_assert(sainsmart::err_interlock == RELAY_ERR_INTERLOCK, "error code out of sync with sainsmartrelay.h");
+
+#define BENCH_OPS 20000000
+
+extern "C" unsigned long g_stub_writes;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * What on<1, 3>() replaces: a shadow byte, a literal mask and one write.
+ * Any cost the template layer adds shows up as the difference to this.
+ */
+struct HandWritten
+{
+    struct ftdi_context *ftdi;
+    uint8_t shadow;
+
+    int on_1_3()
+    {
+        uint8_t data = (uint8_t)(shadow | 0x05);
+        if (ftdi_write_data(ftdi, &data, 1) < 0)
+        {
+            return -4;
+        }
+        shadow = data;
+        return 0;
+    }
+};
+
+static void report(const char *name, unsigned long long start, unsigned long writes)
+{
+    printf("%-28s %10.2f %12.2f\n", name,
+           (double)(now_ns() - start) / BENCH_OPS,
+           (double)(g_stub_writes - writes) / BENCH_OPS);
+}
+
+int main(void)
+{
+    sainsmart::RelayBank<4> bank;
+    sainsmart::RelayBank<4> interlocked;
+    sainsmart::Interlock<4> rules;
+    HandWritten hand = { ftdi_new(), 0 };
+    unsigned long long start;
+    unsigned long writes;
+    unsigned long op;
+    int failures = 0;
+
+    if (bank.open() != 0 || interlocked.open() != 0 || rules.forbid<1, 2>() != 0)
+    {
+        fprintf(stderr, "stub open failed\n");
+        return EXIT_FAILURE;
+    }
+    interlocked.set_interlock(&rules);
+
+    printf("%-28s %10s %12s\n", "operation", "ns/op", "writes/op");
+
+    writes = g_stub_writes;
+    start = now_ns();
+    for (op = 0; op < BENCH_OPS; op++)
+    {
+        failures += hand.on_1_3() != 0;
+    }
+    report("hand-written mask write", start, writes);
+
+    writes = g_stub_writes;
+    start = now_ns();
+    for (op = 0; op < BENCH_OPS; op++)
+    {
+        failures += bank.on<1, 3>() != 0;
+    }
+    report("RelayBank<4>::on<1, 3>()", start, writes);
+
+    writes = g_stub_writes;
+    start = now_ns();
+    for (op = 0; op < BENCH_OPS; op++)
+    {
+        failures += interlocked.on<1, 3>() != 0;
+    }
+    report("  with an interlock rule", start, writes);
+
+    if (bank.state().value() != 0x05 || hand.shadow != 0x05 || failures != 0)
+    {
+        fprintf(stderr, "unexpected relay state\n");
+        return EXIT_FAILURE;
+    }
+    ftdi_free(hand.ftdi);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "relaylist.h"
+#include "alloccount.h"
+
+/* roughly this many list entries are processed per measurement */
+#define BENCH_WORK 4000000
+
+static volatile int g_sink;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, int len, unsigned long ops,
+                   unsigned long long start, unsigned long calls)
+{
+    double ns = (double)(now_ns() - start) / ops;
+
+    printf("%-22s %9d %14.1f %10.1f %12.2f\n", name, len, ns, ns / len,
+           (double)(g_alloc_count.calls - calls) / ops);
+}
+
+/**********************************************************
+ * Function make_list()
+ *
+ * Description: Relay list of len entries cycling through
+ *              the relays of a 4 channel card with repeats
+ *********************************************************/
+static char *make_list(int len, int *values)
+{
+    char *str = malloc((size_t)len * 3 + 1);
+    char *p = str;
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        values[i] = 1 + (i * 7) % 4;
+        p += sprintf(p, "%s%d", (i == 0) ? "" : ",", values[i]);
+    }
+    *p = '\0';
+    return str;
+}
+
+static void bench_len(int len)
+{
+    unsigned long ops = (len < BENCH_WORK) ? BENCH_WORK / len : 1;
+    int *values = malloc(len * sizeof(int));
+    char *str = make_list(len, values);
+    unsigned long long start;
+    unsigned long calls, op;
+    size_t numtokens, i;
+
+    calls = g_alloc_count.calls;
+    start = now_ns();
+    for (op = 0; op < ops; op++)
+    {
+        char **tokens = strsplit(str, ", \t\n", &numtokens);
+        for (i = 0; i < numtokens; i++)
+        {
+            free(tokens[i]);
+        }
+        free(tokens);
+    }
+    report("strsplit", len, ops, start, calls);
+
+    calls = g_alloc_count.calls;
+    start = now_ns();
+    for (op = 0; op < ops; op++)
+    {
+        int *dedup = remove_duplicate(values, len, &numtokens);
+        g_sink += dedup[0];
+        free(dedup);
+    }
+    report("remove_duplicate", len, ops, start, calls);
+
+    calls = g_alloc_count.calls;
+    start = now_ns();
+    for (op = 0; op < ops; op++)
+    {
+        g_sink += relay_mask_from_list(str, 4);
+    }
+    report("relay_mask_from_list", len, ops, start, calls);
+
+    free(str);
+    free(values);
+}
+
+int main(void)
+{
+    static const int lens[] = { 1, 4, 16, 256, 4096, 65536, 1048576 };
+    unsigned long ops = BENCH_WORK;
+    unsigned long long start;
+    unsigned long calls, op;
+    size_t i;
+
+    printf("%-22s %9s %14s %10s %12s\n", "function", "entries", "ns/op", "ns/entry", "allocs/op");
+
+    for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+    {
+        bench_len(lens[i]);
+    }
+
+    calls = g_alloc_count.calls;
+    start = now_ns();
+    for (op = 0; op < ops; op++)
+    {
+        int *bits = get_bits((int)(op & 0xFF), 8);
+        g_sink += bits[op & 7];
+        free(bits);
+    }
+    report("get_bits", 8, ops, start, calls);
+
+    calls = g_alloc_count.calls;
+    start = now_ns();
+    for (op = 0; op < ops; op++)
+    {
+        g_sink += relay_mask_all((uint8)(1 + (op & 7)));
+    }
+    report("relay_mask_all", 8, ops, start, calls);
+
+    return EXIT_SUCCESS;
+}
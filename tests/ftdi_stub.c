@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include <ftdi.h>
+
+/*
+ * No-op libftdi for bench_relaybank: every call succeeds without a
+ * card, and writes are only counted. Kept in its own translation unit
+ * so the compiler cannot fold the calls into the code being measured.
+ */
+unsigned long g_stub_writes;
+
+struct ftdi_context *ftdi_new(void)
+{
+    return calloc(1, sizeof(struct ftdi_context));
+}
+
+void ftdi_free(struct ftdi_context *ftdi)
+{
+    free(ftdi);
+}
+
+int ftdi_usb_open(struct ftdi_context *ftdi, int vendor, int product)
+{
+    return 0;
+}
+
+int ftdi_usb_open_string(struct ftdi_context *ftdi, const char *description)
+{
+    return 0;
+}
+
+int ftdi_usb_close(struct ftdi_context *ftdi)
+{
+    return 0;
+}
+
+int ftdi_set_bitmode(struct ftdi_context *ftdi, unsigned char bitmask, unsigned char mode)
+{
+    return 0;
+}
+
+int ftdi_read_pins(struct ftdi_context *ftdi, unsigned char *pins)
+{
+    *pins = 0;
+    return 0;
+}
+
+int ftdi_write_data(struct ftdi_context *ftdi, unsigned char *buf, int size)
+{
+    g_stub_writes++;
+    return size;
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <ftdi.h>
+
+/*
+ * Simulated relay card for make estop_sim: a libftdi replacement that
+ * the full sainsmartrelay binary links against instead of -lftdi.
+ * The pins follow the last byte written, each write takes
+ * SIMCARD_WRITE_US so racing writes overlap, and the process aborts if
+ * two threads ever use the context at the same time, which libftdi
+ * does not allow. SAINSMART_SIM_PINS sets the pin state at start.
+ */
+#define SIMCARD_WRITE_US 300
+
+static atomic_uchar g_pins;
+static atomic_int g_pins_set;
+static atomic_int g_in_use;
+
+static void sim_enter(const char *call)
+{
+    if (atomic_exchange(&g_in_use, 1) != 0)
+    {
+        fprintf(stderr, "simcard: %s while another thread uses the context\n", call);
+        abort();
+    }
+}
+
+static void sim_leave(void)
+{
+    atomic_store(&g_in_use, 0);
+}
+
+struct ftdi_context *ftdi_new(void)
+{
+    struct ftdi_context *ftdi = calloc(1, sizeof(struct ftdi_context));
+    const char *pins = getenv("SAINSMART_SIM_PINS");
+
+    if (ftdi != NULL)
+    {
+        ftdi->type = TYPE_R;
+    }
+    if (!atomic_exchange(&g_pins_set, 1))
+    {
+        atomic_store(&g_pins, (pins != NULL) ? (unsigned char)strtoul(pins, NULL, 0) : 0xFF);
+    }
+    return ftdi;
+}
+
+void ftdi_free(struct ftdi_context *ftdi)
+{
+    free(ftdi);
+}
+
+int ftdi_usb_open(struct ftdi_context *ftdi, int vendor, int product)
+{
+    return 0;
+}
+
+int ftdi_usb_open_string(struct ftdi_context *ftdi, const char *description)
+{
+    return 0;
+}
+
+int ftdi_usb_open_dev(struct ftdi_context *ftdi, struct usb_device *dev)
+{
+    return 0;
+}
+
+int ftdi_usb_close(struct ftdi_context *ftdi)
+{
+    sim_enter("ftdi_usb_close");
+    sim_leave();
+    return 0;
+}
+
+int ftdi_usb_find_all(struct ftdi_context *ftdi, struct ftdi_device_list **devlist, int vendor, int product)
+{
+    *devlist = NULL;
+    return 0;
+}
+
+void ftdi_list_free(struct ftdi_device_list **devlist)
+{
+}
+
+int ftdi_usb_get_strings(struct ftdi_context *ftdi, struct usb_device *dev, char *manufacturer, int mnf_len,
+                         char *description, int desc_len, char *serial, int serial_len)
+{
+    return -1;
+}
+
+int ftdi_set_bitmode(struct ftdi_context *ftdi, unsigned char bitmask, unsigned char mode)
+{
+    ftdi->bitbang_enabled = 1;
+    return 0;
+}
+
+int ftdi_disable_bitbang(struct ftdi_context *ftdi)
+{
+    ftdi->bitbang_enabled = 0;
+    return 0;
+}
+
+int ftdi_read_pins(struct ftdi_context *ftdi, unsigned char *pins)
+{
+    sim_enter("ftdi_read_pins");
+    *pins = atomic_load(&g_pins);
+    sim_leave();
+    return 0;
+}
+
+int ftdi_write_data(struct ftdi_context *ftdi, unsigned char *buf, int size)
+{
+    sim_enter("ftdi_write_data");
+    usleep(SIMCARD_WRITE_US);
+    atomic_store(&g_pins, buf[size - 1]);
+    sim_leave();
+    return size;
+}
+
+int ftdi_read_data(struct ftdi_context *ftdi, unsigned char *buf, int size)
+{
+    int i;
+
+    sim_enter("ftdi_read_data");
+    usleep(SIMCARD_WRITE_US);
+    for (i = 0; i < size; i++)
+    {
+        buf[i] = atomic_load(&g_pins);
+    }
+    sim_leave();
+    return size;
+}
+
+int ftdi_set_baudrate(struct ftdi_context *ftdi, int baudrate)
+{
+    ftdi->baudrate = ftdi->bitbang_enabled ? baudrate * 4 : baudrate;
+    return 0;
+}
+
+int ftdi_read_data_set_chunksize(struct ftdi_context *ftdi, unsigned int chunksize)
+{
+    return 0;
+}
+
+int ftdi_set_latency_timer(struct ftdi_context *ftdi, unsigned char latency)
+{
+    return 0;
+}
+
+int ftdi_usb_purge_buffers(struct ftdi_context *ftdi)
+{
+    return 0;
+}
+
+int ftdi_read_chipid(struct ftdi_context *ftdi, unsigned int *chipid)
+{
+    *chipid = 0x5A17CA2D;
+    return 0;
+}
+
+char *ftdi_get_error_string(struct ftdi_context *ftdi)
+{
+    return "simulated card";
+}
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "relaylist.h"
+#include "alloccount.h"
+
+#define DEFAULT_ITERATIONS 20000
+#define DEFAULT_SEED       0x5A17u
+#define DEFAULT_BIG_LIST   3000000
+#define MAX_LIST_LEN       64
+#define MIN_VALUE          -3
+#define MAX_VALUE          12
+/* strsplit() doubles its token array, so a list of n relays needs
+ * n + O(log n) allocations; per-element growth would need 2n */
+#define ALLOC_SLACK        64
+#define SCALING_LEN        50000
+#define SCALING_RUNS       5
+#define SCALING_MAX_RATIO  3.0
+
+static unsigned long g_failures=0;
+static unsigned int g_rng;
+
+#define CHECK(cond, ...) \
+    do { if (!(cond)) { g_failures++; fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+         fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); } } while (0)
+
+/**********************************************************
+ * Function rng()
+ *
+ * Description: xorshift32, so a failing seed can be replayed
+ *********************************************************/
+static unsigned int rng(void)
+{
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 17;
+    g_rng ^= g_rng << 5;
+    return g_rng;
+}
+
+static int rng_range(int lo, int hi)
+{
+    return lo + (int)(rng() % (unsigned int)(hi - lo + 1));
+}
+
+/**********************************************************
+ * Function reference_mask()
+ *
+ * Description: Straightforward mask of the listed relays,
+ *              used as the oracle for relay_mask_from_list()
+ *********************************************************/
+static uint8 reference_mask(const int *values, int count, uint8 num_relays)
+{
+    uint8 mask = 0;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (values[i] >= FIRST_RELAY && values[i] < FIRST_RELAY + num_relays)
+        {
+            mask |= 1u << (values[i] - FIRST_RELAY);
+        }
+    }
+    return mask;
+}
+
+/**********************************************************
+ * Function format_list()
+ *
+ * Description: Print values as a relay list with random
+ *              separators taken from the ones --on accepts
+ *********************************************************/
+static void format_list(const int *values, int count, char *str)
+{
+    static const char *seps[] = { ",", ", ", " ", ",\t", " ,\n", ",," };
+    int i;
+
+    *str = '\0';
+    if (rng() % 4 == 0)
+    {
+        str += sprintf(str, " ");
+    }
+    for (i = 0; i < count; i++)
+    {
+        str += sprintf(str, "%s%d", (i == 0) ? "" : seps[rng() % 6], values[i]);
+    }
+    if (rng() % 4 == 0)
+    {
+        sprintf(str, ",");
+    }
+}
+
+static void check_strsplit(const int *values, int count, const char *str)
+{
+    size_t numtokens = 0;
+    char **tokens = strsplit(str, ", \t\n", &numtokens);
+    size_t i;
+
+    CHECK(numtokens == (size_t)count, "strsplit(\"%s\") gave %zu tokens, expected %d", str, numtokens, count);
+    for (i = 0; i < numtokens; i++)
+    {
+        if (i < (size_t)count)
+        {
+            CHECK(atoi(tokens[i]) == values[i], "strsplit(\"%s\") token %zu is \"%s\"", str, i, tokens[i]);
+        }
+        free(tokens[i]);
+    }
+    free(tokens);
+}
+
+static void check_remove_duplicate(const int *values, int count)
+{
+    int copy[MAX_LIST_LEN];
+    int seen[MAX_VALUE - MIN_VALUE + 1] = { 0 };
+    int distinct = 0;
+    size_t numtok = 0;
+    size_t i;
+    unsigned long calls;
+    int *dedup;
+
+    memcpy(copy, values, count * sizeof(int));
+    for (i = 0; i < (size_t)count; i++)
+    {
+        if (seen[values[i] - MIN_VALUE]++ == 0)
+        {
+            distinct++;
+        }
+    }
+
+    calls = g_alloc_count.calls;
+    dedup = remove_duplicate(copy, count, &numtok);
+    CHECK(g_alloc_count.calls - calls == (count ? 1u : 0u),
+          "remove_duplicate() of %d values made %lu allocations", count, g_alloc_count.calls - calls);
+    CHECK(memcmp(copy, values, count * sizeof(int)) == 0, "remove_duplicate() modified its input");
+    CHECK(numtok == (size_t)distinct, "remove_duplicate() kept %zu of %d distinct values", numtok, distinct);
+    CHECK((count == 0) == (dedup == NULL), "remove_duplicate() returned %p for %d values", (void *)dedup, count);
+    for (i = 0; i < numtok; i++)
+    {
+        CHECK(dedup[i] >= MIN_VALUE && dedup[i] <= MAX_VALUE && seen[dedup[i] - MIN_VALUE],
+              "remove_duplicate() invented value %d", dedup[i]);
+        CHECK(i == 0 || dedup[i-1] < dedup[i], "remove_duplicate() result not strictly ascending at %zu", i);
+    }
+    free(dedup);
+}
+
+static void check_get_bits(void)
+{
+    int n = rng_range(0, 0xFF);
+    int bitswanted = rng_range(1, 8);
+    int *bits = get_bits(n, bitswanted);
+    int k;
+
+    for (k = 0; k < bitswanted; k++)
+    {
+        CHECK(bits[k] == ((n >> k) & 1), "get_bits(0x%02X, %d)[%d] = %d", n, bitswanted, k, bits[k]);
+    }
+    free(bits);
+}
+
+static void check_masks(const int *values, int count, const char *str)
+{
+    uint8 num_relays = (uint8)rng_range(1, 8);
+    uint8 all = relay_mask_all(num_relays);
+    uint8 expected = reference_mask(values, count, num_relays);
+    unsigned long calls = g_alloc_count.calls;
+    uint8 mask = relay_mask_from_list(str, num_relays);
+
+    CHECK(g_alloc_count.calls - calls <= (unsigned long)count + ALLOC_SLACK,
+          "relay_mask_from_list() of %d relays made %lu allocations", count, g_alloc_count.calls - calls);
+
+    CHECK(all == (uint8)((1u << num_relays) - 1), "relay_mask_all(%u) = 0x%02X", num_relays, all);
+    CHECK(mask == expected, "relay_mask_from_list(\"%s\", %u) = 0x%02X, expected 0x%02X", str, num_relays, mask, expected);
+    CHECK((mask & ~all) == 0, "relay_mask_from_list(\"%s\", %u) set bits beyond the card", str, num_relays);
+}
+
+/**********************************************************
+ * Function check_list_parse()
+ *
+ * Description: relay_list_parse() must agree with the lenient
+ *              parser on valid lists and reject everything else
+ *********************************************************/
+static void check_list_parse(const int *values, int count, const char *str)
+{
+    uint8 num_relays = (uint8)rng_range(1, 8);
+    int valid = (count > 0);
+    uint8 mask;
+    int i, ret;
+
+    for (i = 0; i < count; i++)
+    {
+        if (values[i] < FIRST_RELAY || values[i] >= FIRST_RELAY + num_relays)
+        {
+            valid = 0;
+        }
+    }
+    ret = relay_list_parse(str, num_relays, &mask);
+    CHECK(ret == (valid ? 0 : -1), "relay_list_parse(\"%s\", %u) returned %d", str, num_relays, ret);
+    if (ret == 0)
+    {
+        CHECK(mask == reference_mask(values, count, num_relays),
+              "relay_list_parse(\"%s\", %u) = 0x%02X", str, num_relays, mask);
+    }
+}
+
+static void check_list_parse_rejects(void)
+{
+    static const char *bad[] = { "", " , ", "abc", "1x", "1,x", "+1", "-1", "1;2", "0", "5", "99999999999999999999" };
+    uint8 mask;
+    size_t i;
+
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        CHECK(relay_list_parse(bad[i], 4, &mask) == -1, "relay_list_parse(\"%s\", 4) accepted", bad[i]);
+    }
+    CHECK(relay_list_parse("ALL", 4, &mask) == 0 && mask == 0x0F, "relay_list_parse(\"ALL\", 4) = 0x%02X", mask);
+}
+
+/**********************************************************
+ * Function check_big_list()
+ *
+ * Description: A relay list with millions of entries used to
+ *              overflow the stack in relay_mask_from_list()
+ *********************************************************/
+static void check_big_list(int len)
+{
+    char *str = malloc((size_t)len * 2 + 1);
+    char *p = str;
+    unsigned long calls;
+    uint8 mask;
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        *p++ = (char)('1' + i % 4);
+        *p++ = ',';
+    }
+    *p = '\0';
+
+    calls = g_alloc_count.calls;
+    mask = relay_mask_from_list(str, 4);
+    CHECK(mask == ((len >= 4) ? 0x0F : (1u << len) - 1), "%d entry list gave mask 0x%02X", len, mask);
+    CHECK(g_alloc_count.calls - calls <= (unsigned long)len + ALLOC_SLACK,
+          "%d entry list made %lu allocations", len, g_alloc_count.calls - calls);
+    free(str);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**********************************************************
+ * Function time_lists()
+ *
+ * Description: Best of SCALING_RUNS timings of remove_duplicate()
+ *              and relay_mask_from_list() on len distinct values
+ *              in shuffled order
+ *********************************************************/
+static void time_lists(int len, double *dedup_sec, double *mask_sec)
+{
+    int *values = malloc(len * sizeof(int));
+    char *str = malloc((size_t)len * 12 + 1);
+    char *p = str;
+    size_t numtok;
+    double t;
+    int i, j, tmp, run;
+
+    for (i = 0; i < len; i++)
+    {
+        values[i] = i + 1;
+    }
+    for (i = len - 1; i > 0; i--)
+    {
+        j = (int)(rng() % (unsigned int)(i + 1));
+        tmp = values[i]; values[i] = values[j]; values[j] = tmp;
+    }
+    for (i = 0; i < len; i++)
+    {
+        p += sprintf(p, "%s%d", (i == 0) ? "" : ",", values[i]);
+    }
+
+    *dedup_sec = *mask_sec = 1e9;
+    for (run = 0; run < SCALING_RUNS; run++)
+    {
+        t = now_sec();
+        free(remove_duplicate(values, len, &numtok));
+        t = now_sec() - t;
+        if (t < *dedup_sec)
+        {
+            *dedup_sec = t;
+        }
+
+        t = now_sec();
+        relay_mask_from_list(str, 8);
+        t = now_sec() - t;
+        if (t < *mask_sec)
+        {
+            *mask_sec = t;
+        }
+    }
+    free(str);
+    free(values);
+}
+
+/**********************************************************
+ * Function check_scaling()
+ *
+ * Description: Doubling a list of distinct relay numbers must
+ *              not much more than double the parsing time; a
+ *              quadratic dedup or growth would quadruple it
+ *********************************************************/
+static void check_scaling(int len)
+{
+    double dedup1, mask1, dedup2, mask2;
+
+    time_lists(len, &dedup1, &mask1);
+    time_lists(2 * len, &dedup2, &mask2);
+    CHECK(dedup2 < SCALING_MAX_RATIO * dedup1, "remove_duplicate() took %.2f ms for %d values, %.2f ms for %d",
+          dedup1 * 1e3, len, dedup2 * 1e3, 2 * len);
+    CHECK(mask2 < SCALING_MAX_RATIO * mask1, "relay_mask_from_list() took %.2f ms for %d relays, %.2f ms for %d",
+          mask1 * 1e3, len, mask2 * 1e3, 2 * len);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_ITERATIONS;
+    unsigned int seed = (argc > 2) ? (unsigned int)strtoul(argv[2], NULL, 0) : DEFAULT_SEED;
+    int big_list = (argc > 3) ? atoi(argv[3]) : DEFAULT_BIG_LIST;
+    int values[MAX_LIST_LEN];
+    char str[MAX_LIST_LEN * 8 + 4];
+    unsigned long it;
+    long live;
+    int count, i;
+
+    g_rng = seed ? seed : DEFAULT_SEED;
+    live = g_alloc_count.live;
+
+    for (it = 0; it < iterations; it++)
+    {
+        count = rng_range(0, MAX_LIST_LEN);
+        for (i = 0; i < count; i++)
+        {
+            values[i] = rng_range(MIN_VALUE, MAX_VALUE);
+        }
+        format_list(values, count, str);
+
+        check_strsplit(values, count, str);
+        check_remove_duplicate(values, count);
+        check_get_bits();
+        check_masks(values, count, str);
+        check_list_parse(values, count, str);
+    }
+    CHECK(g_alloc_count.live == live, "%ld blocks leaked", g_alloc_count.live - live);
+
+    check_list_parse_rejects();
+    if (big_list > 0)
+    {
+        check_big_list(big_list);
+    }
+    check_scaling(SCALING_LEN);
+
+    printf("%lu iterations, seed 0x%X, %d entry list: %lu failures\n",
+           iterations, seed, big_list, g_failures);
+    return g_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
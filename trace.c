@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+int g_trace_enabled = 0;
+
+static FILE *g_trace_fp = NULL;
+static trace_record_t g_trace_ring[TRACE_RING_SIZE];
+static atomic_ulong g_trace_seq[TRACE_RING_SIZE];   /* index + 1 once a slot is filled */
+static atomic_ulong g_trace_head;                   /* next slot to claim */
+static atomic_ulong g_trace_tail;                   /* next slot to flush */
+static atomic_ulong g_trace_dropped;
+static atomic_flag g_trace_flushing = ATOMIC_FLAG_INIT;
+static atomic_int g_trace_stop;
+static pthread_t g_trace_writer;
+
+static const char *trace_op_names[TRACE_OP_COUNT] =
+{
+    "open", "set_bitmode", "read_pins", "write", "close", "dropped",
+    "read_data", "set_baudrate", "purge", "read_chipid"
+};
+
+/**********************************************************
+ * Function trace_op_name()
+ *
+ * Description: Printable name of a trace operation
+ *********************************************************/
+const char *trace_op_name(int op)
+{
+    return (op >= 0 && op < TRACE_OP_COUNT) ? trace_op_names[op] : "unknown";
+}
+
+/**********************************************************
+ * Function trace_now_ns()
+ *
+ * Description: Monotonic timestamp in nanoseconds
+ *********************************************************/
+uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**********************************************************
+ * Function trace_writer()
+ *
+ * Description: Background thread that moves completed records
+ *              from the ring to the trace file, so the file I/O
+ *              never runs on the thread doing the USB operation
+ *
+ * Parameters: arg (in) - unused
+ *********************************************************/
+static void *trace_writer(void *arg)
+{
+    struct timespec idle = { 0, TRACE_FLUSH_INTERVAL_MS * 1000000L };
+
+    (void)arg;
+    while (!atomic_load(&g_trace_stop))
+    {
+        trace_flush();
+        nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+/**********************************************************
+ * Function trace_open()
+ *
+ * Description: Start recording device operations to a file
+ *
+ * Parameters: path (in) - trace file
+ *
+ * Return:    0 - success
+ *           -1 - fail, file could not be created or the
+ *                writer thread could not be started
+ *********************************************************/
+int trace_open(const char *path)
+{
+    unsigned char header[8] = { 0 };
+
+    if ((g_trace_fp = fopen(path, "wb")) == NULL)
+    {
+        fprintf(stderr, "unable to open trace file %s\n", path);
+        return -1;
+    }
+    memcpy(header, TRACE_MAGIC, 4);
+    header[4] = TRACE_VERSION;
+    fwrite(header, 1, sizeof(header), g_trace_fp);
+
+    atomic_store(&g_trace_stop, 0);
+    if (pthread_create(&g_trace_writer, NULL, trace_writer, NULL) != 0)
+    {
+        fprintf(stderr, "unable to start trace writer thread\n");
+        fclose(g_trace_fp);
+        g_trace_fp = NULL;
+        return -1;
+    }
+
+    g_trace_enabled = 1;
+    atexit(trace_close);
+    return 0;
+}
+
+/**********************************************************
+ * Function trace_record()
+ *
+ * Description: Append a record to the trace ring. Slots are
+ *              claimed lock-free; when the ring is full the
+ *              record is counted as dropped instead of waiting.
+ *              The file is written by the trace writer thread.
+ *
+ * Parameters: op (in)       - operation
+ *             start_ns (in) - timestamp taken before the operation
+ *             result (in)   - libftdi return code
+ *             data (in)     - data byte of the operation
+ *********************************************************/
+void trace_record(trace_op_t op, uint64_t start_ns, int result, uint8 data)
+{
+    uint64_t end_ns = trace_now_ns();
+    unsigned long head = atomic_load(&g_trace_head);
+    trace_record_t *rec;
+
+    do
+    {
+        if (head - atomic_load(&g_trace_tail) >= TRACE_RING_SIZE)
+        {
+            atomic_fetch_add(&g_trace_dropped, 1);
+            return;
+        }
+    }
+    while (!atomic_compare_exchange_weak(&g_trace_head, &head, head + 1));
+
+    rec = &g_trace_ring[head & (TRACE_RING_SIZE-1)];
+    rec->start_ns = start_ns;
+    rec->duration_ns = (end_ns - start_ns) > UINT32_MAX ? UINT32_MAX : (uint32_t)(end_ns - start_ns);
+    rec->result = result < INT16_MIN ? INT16_MIN : result;
+    rec->op = op;
+    rec->data = data;
+    atomic_store_explicit(&g_trace_seq[head & (TRACE_RING_SIZE-1)], head + 1, memory_order_release);
+}
+
+/**********************************************************
+ * Function trace_flush()
+ *
+ * Description: Write all completed records to the trace file.
+ *              Only one thread flushes at a time; others return
+ *              immediately and leave the work to it.
+ *********************************************************/
+void trace_flush(void)
+{
+    unsigned long tail;
+
+    if (g_trace_fp == NULL || atomic_flag_test_and_set(&g_trace_flushing))
+    {
+        return;
+    }
+
+    tail = atomic_load(&g_trace_tail);
+    while (tail != atomic_load(&g_trace_head) &&
+            atomic_load_explicit(&g_trace_seq[tail & (TRACE_RING_SIZE-1)], memory_order_acquire) == tail + 1)
+    {
+        fwrite(&g_trace_ring[tail & (TRACE_RING_SIZE-1)], sizeof(trace_record_t), 1, g_trace_fp);
+        atomic_store(&g_trace_tail, ++tail);
+    }
+
+    atomic_flag_clear(&g_trace_flushing);
+}
+
+/**********************************************************
+ * Function trace_close()
+ *
+ * Description: Stop the writer thread, flush outstanding
+ *              records, note any dropped records and close
+ *              the trace file
+ *********************************************************/
+void trace_close(void)
+{
+    unsigned long dropped;
+
+    if (g_trace_fp == NULL)
+    {
+        return;
+    }
+
+    g_trace_enabled = 0;
+    atomic_store(&g_trace_stop, 1);
+    pthread_join(g_trace_writer, NULL);
+    trace_flush();
+
+    if ((dropped = atomic_load(&g_trace_dropped)) != 0)
+    {
+        trace_record_t rec = { trace_now_ns(), dropped > UINT32_MAX ? UINT32_MAX : dropped, 0, TRACE_OP_DROPPED, 0 };
+        fwrite(&rec, sizeof(rec), 1, g_trace_fp);
+    }
+
+    fclose(g_trace_fp);
+    g_trace_fp = NULL;
+}
@@ -0,0 +1,144 @@
+#ifndef trace_h
+#define trace_h
+
+#include <stdint.h>
+#include <ftdi.h>
+
+#include "sainsmartrelay.h"
+
+#define TRACE_MAGIC     "SRTR"
+#define TRACE_VERSION   1
+#define TRACE_RING_SIZE 4096    /* must be a power of two */
+#define TRACE_FLUSH_INTERVAL_MS 10
+#define TRACE_ENV       "SAINSMART_TRACE"
+
+typedef enum
+{
+    TRACE_OP_OPEN = 0,
+    TRACE_OP_SET_BITMODE,
+    TRACE_OP_READ_PINS,
+    TRACE_OP_WRITE,
+    TRACE_OP_CLOSE,
+    TRACE_OP_DROPPED,           /* duration_ns holds the number of lost records */
+    TRACE_OP_READ_DATA,         /* result is the number of bytes read, data the last one */
+    TRACE_OP_SET_BAUDRATE,
+    TRACE_OP_PURGE,
+    TRACE_OP_READ_CHIPID,
+    TRACE_OP_COUNT
+}
+trace_op_t;
+
+/*
+ * One fixed size record per USB operation. Records are stored in host
+ * (little endian on all supported targets) byte order after the 8 byte
+ * file header: magic, version and three reserved bytes.
+ */
+typedef struct
+{
+    uint64_t start_ns;          /* CLOCK_MONOTONIC at the start of the operation */
+    uint32_t duration_ns;
+    int16_t result;             /* libftdi return code */
+    uint8 op;                   /* trace_op_t */
+    uint8 data;                 /* byte written or read, bitmode direction mask */
+}
+trace_record_t;
+
+extern int g_trace_enabled;
+
+int trace_open(const char *path);
+void trace_close(void);
+void trace_flush(void);
+uint64_t trace_now_ns(void);
+void trace_record(trace_op_t op, uint64_t start_ns, int result, uint8 data);
+const char *trace_op_name(int op);
+
+/*
+ * Traced wrappers around the libftdi calls that touch the device.
+ * With tracing disabled they cost one predictable branch.
+ */
+static inline uint64_t trace_begin(void)
+{
+    return g_trace_enabled ? trace_now_ns() : 0;
+}
+
+static inline int traced_usb_open(struct ftdi_context *ftdi, int vendor, int product)
+{
+    uint64_t t0 = trace_begin();
+    int ret = ftdi_usb_open(ftdi, vendor, product);
+    if (g_trace_enabled) trace_record(TRACE_OP_OPEN, t0, ret, 0);
+    return ret;
+}
+
+static inline int traced_usb_open_string(struct ftdi_context *ftdi, const char *description)
+{
+    uint64_t t0 = trace_begin();
+    int ret = ftdi_usb_open_string(ftdi, description);
+    if (g_trace_enabled) trace_record(TRACE_OP_OPEN, t0, ret, 0);
+    return ret;
+}
+
+static inline int traced_set_bitmode(struct ftdi_context *ftdi, unsigned char bitmask, unsigned char mode)
+{
+    uint64_t t0 = trace_begin();
+    int ret = ftdi_set_bitmode(ftdi, bitmask, mode);
+    if (g_trace_enabled) trace_record(TRACE_OP_SET_BITMODE, t0, ret, bitmask);
+    return ret;
+}
+
+static inline int traced_read_pins(struct ftdi_context *ftdi, unsigned char *pins)
+{
+    uint64_t t0 = trace_begin();
+    int ret = ftdi_read_pins(ftdi, pins);
+    if (g_trace_enabled) trace_record(TRACE_OP_READ_PINS, t0, ret, ret < 0 ? 0 : *pins);
+    return ret;
+}
+
+static inline int traced_write(struct ftdi_context *ftdi, unsigned char *buf, int size)
+{
+    uint64_t t0 = trace_begin();
+    int ret = ftdi_write_data(ftdi, buf, size);
+    if (g_trace_enabled) trace_record(TRACE_OP_WRITE, t0, ret, buf[size-1]);
+    return ret;
+}
+
+static inline int traced_read_data(struct ftdi_context *ftdi, unsigned char *buf, int size)
+{
+    uint64_t t0 = trace_begin();
+    int ret = ftdi_read_data(ftdi, buf, size);
+    if (g_trace_enabled) trace_record(TRACE_OP_READ_DATA, t0, ret, ret > 0 ? buf[ret-1] : 0);
+    return ret;
+}
+
+static inline int traced_set_baudrate(struct ftdi_context *ftdi, int baudrate)
+{
+    uint64_t t0 = trace_begin();
+    int ret = ftdi_set_baudrate(ftdi, baudrate);
+    if (g_trace_enabled) trace_record(TRACE_OP_SET_BAUDRATE, t0, ret, 0);
+    return ret;
+}
+
+static inline int traced_usb_purge_buffers(struct ftdi_context *ftdi)
+{
+    uint64_t t0 = trace_begin();
+    int ret = ftdi_usb_purge_buffers(ftdi);
+    if (g_trace_enabled) trace_record(TRACE_OP_PURGE, t0, ret, 0);
+    return ret;
+}
+
+static inline int traced_read_chipid(struct ftdi_context *ftdi, unsigned int *chipid)
+{
+    uint64_t t0 = trace_begin();
+    int ret = ftdi_read_chipid(ftdi, chipid);
+    if (g_trace_enabled) trace_record(TRACE_OP_READ_CHIPID, t0, ret, 0);
+    return ret;
+}
+
+static inline int traced_usb_close(struct ftdi_context *ftdi)
+{
+    uint64_t t0 = trace_begin();
+    int ret = ftdi_usb_close(ftdi);
+    if (g_trace_enabled) trace_record(TRACE_OP_CLOSE, t0, ret, 0);
+    return ret;
+}
+
+#endif